@@ -61,6 +61,7 @@ source/neural-network.cxx
 # -Wl,--entry=_start \
 # -mextendend-const \
 # -matomics \
+# -DIMPORTED_MATH \
 
 clang++ \
 --target=wasm32 \
@@ -20,7 +20,7 @@ If not, see <https://www.gnu.org/licenses/>.
 import { SectionWorker } from "../section-worker.js";
 
 import { MovieReader } from "../movie-reader.js";
-import { channelsRgb, channelsRgba, nearestValidImageSize, argmax, argmaxWithinCircle } from "../image.js";
+import { channelsRgb, channelsRgba, nearestValidImageSize } from "../image.js";
 import { NeuralNetwork } from "../neural-network.js";
 import { testZip } from "../zip.js";
 
@@ -190,6 +190,9 @@ class AnalyzingWorker extends SectionWorker {
 
     this.neuralNetwork = new NeuralNetwork(channelsRgb, json.channelCount, json.keypointCount, json.blockCount, json.maxImageSize, null);
     this.neuralNetwork.setParameters(json.bestWeights);
+    if (json.bestActivationRanges) {
+      this.neuralNetwork.quantize(json.bestActivationRanges);
+    }
 
     self.postMessage({ type: "loadModelSuccess", filename: fileHandle.name });
   }
@@ -234,18 +237,15 @@ class AnalyzingWorker extends SectionWorker {
       const resizedGaussianHeight = resizedHeight / 2;
       const resizedGaussianWidth = resizedWidth / 2;
 
-      temp.neuralNetwork.resize(imageData.data, arena.height, arena.width, resizedHeight, resizedWidth);
-
-      temp.neuralNetwork.forward(temp.neuralNetwork.resizedOffset, resizedHeight, resizedWidth, channelsRgb);
+      temp.neuralNetwork.resizeRgba(imageData.data, arena.height, arena.width, resizedHeight, resizedWidth);
 
-      const predictions = temp.neuralNetwork.predictions();
-      let predictionCoordinates = null;
-      if (temp.arenaShape === "circle") {
-        predictionCoordinates = argmaxWithinCircle(predictions, resizedGaussianHeight, temp.data.keypointCount);
-      }
-      else {
-        predictionCoordinates = argmax(predictions, resizedGaussianHeight, resizedGaussianWidth, temp.data.keypointCount);
-      }
+      const predictionCoordinates = temp.neuralNetwork.forwardPeaks(
+        temp.neuralNetwork.resizedOffset,
+        resizedHeight,
+        resizedWidth,
+        channelsRgba,
+        temp.arenaShape === "circle"
+      );
       for (let i = 0; i < predictionCoordinates.length; ++i) {
         predictionCoordinates[i].y *= resizedHeight / resizedGaussianHeight;
         predictionCoordinates[i].x *= resizedWidth / resizedGaussianWidth;
@@ -21,6 +21,7 @@ If not, see <https://www.gnu.org/licenses/>.
 #include <limits.h>
 #include <stdalign.h>
 #include <stdint.h>
+#include <wasm_simd128.h>
 
 static_assert(sizeof(float) == 4);
 static_assert(sizeof(double) == 8);
@@ -28,6 +29,13 @@ static_assert(sizeof(double) == 8);
 int32_t constexpr channels_rgb = 3;
 int32_t constexpr channels_rgba = 4;
 
+// Half-precision tensors are stored as bfloat16, the upper half of a float. It keeps the exponent range of a float,
+// so activations need no scaling, and widens back to a float with a shift.
+struct bfloat16
+{
+  uint16_t bits;
+};
+
 extern "C"
 {
   extern uint8_t *__heap_base;
@@ -37,10 +45,12 @@ extern "C"
     return (void *)&__heap_base;
   }
 
+#ifdef IMPORTED_MATH
   extern auto exp(float x) -> float;
-  extern auto pow(float base, int32_t exponent) -> float;
+  extern auto pow(float base, float exponent) -> float;
   extern auto cos(float x) -> float;
   extern auto sin(float x) -> float;
+#endif
 
   auto _start() -> void
   {
@@ -60,7 +70,8 @@ extern "C"
                    int32_t size) -> void;
   auto add_backward(float const *__restrict__ d_y,
                     float *__restrict__ d_x,
-                    int32_t size) -> void;
+                    int32_t size,
+                    int32_t accumulate) -> void;
 
   auto hard_swish_forward(float const *__restrict__ x,
                           float *__restrict__ y,
@@ -68,7 +79,8 @@ extern "C"
   auto hard_swish_backward(float const *__restrict__ d_y,
                            float *__restrict__ d_x,
                            float const *__restrict__ x,
-                           int32_t size) -> void;
+                           int32_t size,
+                           int32_t accumulate) -> void;
 
   auto dropout_forward(float const *__restrict__ x,
                        float *__restrict__ y,
@@ -82,7 +94,8 @@ extern "C"
                         float const *__restrict__ mask,
                         int32_t x_h,
                         int32_t x_w,
-                        int32_t x_c) -> void;
+                        int32_t x_c,
+                        int32_t accumulate) -> void;
 
   auto pixel_unshuffle_forward(float const *__restrict__ x,
                                float *__restrict__ y,
@@ -93,7 +106,8 @@ extern "C"
                                 float *__restrict__ d_x,
                                 int32_t x_h,
                                 int32_t x_w,
-                                int32_t x_c) -> void;
+                                int32_t x_c,
+                                int32_t accumulate) -> void;
 
   auto pixel_shuffle_forward(float const *__restrict__ x,
                              float *__restrict__ y,
@@ -104,7 +118,8 @@ extern "C"
                               float *__restrict__ d_x,
                               int32_t x_h,
                               int32_t x_w,
-                              int32_t x_c) -> void;
+                              int32_t x_c,
+                              int32_t accumulate) -> void;
 
   auto instance_normalization_forward(float const *__restrict__ x,
                                       float *__restrict__ y,
@@ -115,7 +130,21 @@ extern "C"
                                       float epsilon,
                                       int32_t x_h,
                                       int32_t x_w,
-                                      int32_t x_c) -> void;
+                                      int32_t x_c,
+                                      int32_t blocked) -> void;
+  auto instance_normalization_forward_from_sums(float const *__restrict__ x,
+                                                float *__restrict__ y,
+                                                float const *__restrict__ gamma,
+                                                float const *__restrict__ beta,
+                                                float *__restrict__ sample_mean,
+                                                float *__restrict__ sample_std_dev,
+                                                float const *__restrict__ x_sum,
+                                                float const *__restrict__ x_sum_of_squares,
+                                                float epsilon,
+                                                int32_t x_h,
+                                                int32_t x_w,
+                                                int32_t x_c,
+                                                int32_t blocked) -> void;
   auto instance_normalization_backward(float const *__restrict__ d_y,
                                        float *__restrict__ d_x,
                                        float *__restrict__ d_gamma,
@@ -124,59 +153,289 @@ extern "C"
                                        float const *__restrict__ sample_mean,
                                        float const *__restrict__ sample_std_dev,
                                        float const *__restrict__ x,
-                                       float *__restrict__ sum_1,
-                                       float *__restrict__ sum_2,
                                        int32_t x_h,
                                        int32_t x_w,
-                                       int32_t x_c) -> void;
-
+                                       int32_t x_c,
+                                       int32_t blocked,
+                                       int32_t accumulate) -> void;
+
+  auto pack_pointwise_convolution_kernel(float const *__restrict__ kernel,
+                                         float *__restrict__ packed_kernel,
+                                         float *__restrict__ packed_kernel_transposed,
+                                         int32_t channels_in,
+                                         int32_t channels_out) -> void;
   auto pointwise_convolution_forward(float const *__restrict__ in,
                                      float *__restrict__ out,
-                                     float const *__restrict__ kernel,
+                                     float const *__restrict__ packed_kernel,
                                      float const *__restrict__ bias,
                                      int32_t height,
                                      int32_t width,
                                      int32_t channels_in,
-                                     int32_t channels_out) -> void;
+                                     int32_t channels_out,
+                                     int32_t blocked_in,
+                                     int32_t blocked_out) -> void;
   auto pointwise_convolution_backward(float const *__restrict__ d_out,
                                       float *__restrict__ d_in,
                                       float *__restrict__ d_kernel,
                                       float *__restrict__ d_bias,
                                       float const *__restrict__ in,
-                                      float const *__restrict__ kernel,
-                                      float *__restrict__ kernel_buffer,
+                                      float const *__restrict__ packed_kernel_transposed,
                                       int32_t height,
                                       int32_t width,
                                       int32_t channels_in,
-                                      int32_t channels_out) -> void;
+                                      int32_t channels_out,
+                                      int32_t blocked_in,
+                                      int32_t blocked_out,
+                                      int32_t accumulate) -> void;
+  auto pack_pointwise_convolution_kernel_scaled(float const *__restrict__ kernel,
+                                                float *__restrict__ packed_kernel,
+                                                int32_t channels_in,
+                                                int32_t channels_out,
+                                                float scale) -> void;
+  auto pixel_unshuffle_pointwise_convolution_forward(float const *__restrict__ x,
+                                                     float *__restrict__ y,
+                                                     float *__restrict__ unshuffled,
+                                                     float const *__restrict__ packed_kernel,
+                                                     float const *__restrict__ bias,
+                                                     int32_t height,
+                                                     int32_t width,
+                                                     int32_t channels_out) -> void;
+  auto pixel_unshuffle_pointwise_convolution_rgba_forward(uint8_t const *__restrict__ x,
+                                                          float *__restrict__ y,
+                                                          float const *__restrict__ packed_kernel,
+                                                          float const *__restrict__ bias,
+                                                          int32_t height,
+                                                          int32_t width,
+                                                          int32_t channels_out) -> void;
+  auto pointwise_convolution_pixel_shuffle_argmax(float const *__restrict__ in,
+                                                  float const *__restrict__ packed_kernel,
+                                                  float const *__restrict__ bias,
+                                                  float *__restrict__ scratch,
+                                                  float *__restrict__ peak_values,
+                                                  int32_t *__restrict__ peak_indices,
+                                                  int32_t height,
+                                                  int32_t width,
+                                                  int32_t channels_in,
+                                                  int32_t channels_out,
+                                                  int32_t within_circle) -> void;
+  auto pointwise_convolution_pixel_shuffle_backward_sparse(float const *__restrict__ d_y,
+                                                           float *__restrict__ d_in,
+                                                           float *__restrict__ d_kernel,
+                                                           float *__restrict__ d_bias,
+                                                           float const *__restrict__ in,
+                                                           float const *__restrict__ packed_kernel_transposed,
+                                                           float *__restrict__ scratch,
+                                                           int32_t const *__restrict__ rows,
+                                                           int32_t row_count,
+                                                           int32_t height,
+                                                           int32_t width,
+                                                           int32_t channels_in,
+                                                           int32_t channels_out,
+                                                           int32_t accumulate) -> void;
+  auto pointwise_convolution_hard_swish_forward(float const *__restrict__ in,
+                                                float *__restrict__ out,
+                                                float *__restrict__ pre_activation,
+                                                float const *__restrict__ packed_kernel,
+                                                float const *__restrict__ bias,
+                                                int32_t height,
+                                                int32_t width,
+                                                int32_t channels_in,
+                                                int32_t channels_out,
+                                                int32_t blocked_in,
+                                                int32_t blocked_out) -> void;
+  auto pointwise_convolution_hard_swish_backward(float const *__restrict__ d_out,
+                                                 float *__restrict__ d_in,
+                                                 float *__restrict__ d_kernel,
+                                                 float *__restrict__ d_bias,
+                                                 float const *__restrict__ in,
+                                                 float const *__restrict__ pre_activation,
+                                                 float *__restrict__ d_pre_activation,
+                                                 float const *__restrict__ packed_kernel_transposed,
+                                                 int32_t height,
+                                                 int32_t width,
+                                                 int32_t channels_in,
+                                                 int32_t channels_out,
+                                                 int32_t blocked_in,
+                                                 int32_t blocked_out,
+                                                 int32_t accumulate) -> void;
+  auto pointwise_convolution_hard_swish_forward_bf16(float const *__restrict__ in,
+                                                     bfloat16 *__restrict__ out,
+                                                     bfloat16 *__restrict__ pre_activation,
+                                                     float const *__restrict__ packed_kernel,
+                                                     float const *__restrict__ bias,
+                                                     int32_t height,
+                                                     int32_t width,
+                                                     int32_t channels_in,
+                                                     int32_t channels_out,
+                                                     int32_t blocked_in,
+                                                     int32_t blocked_out) -> void;
+  auto pointwise_convolution_hard_swish_backward_bf16(float const *__restrict__ d_out,
+                                                      float *__restrict__ d_in,
+                                                      float *__restrict__ d_kernel,
+                                                      float *__restrict__ d_bias,
+                                                      float const *__restrict__ in,
+                                                      bfloat16 const *__restrict__ pre_activation,
+                                                      float *__restrict__ d_pre_activation,
+                                                      float const *__restrict__ packed_kernel_transposed,
+                                                      int32_t height,
+                                                      int32_t width,
+                                                      int32_t channels_in,
+                                                      int32_t channels_out,
+                                                      int32_t blocked_in,
+                                                      int32_t blocked_out,
+                                                      int32_t accumulate) -> void;
 
   auto depthwise_convolution_forward(float const *__restrict__ x,
                                      float *__restrict__ y,
                                      float const *__restrict__ k,
                                      [[maybe_unused]] float const *__restrict__ b,
+                                     float *__restrict__ row_buffer,
+                                     float *__restrict__ sum,
+                                     float *__restrict__ sum_of_squares,
                                      int32_t height,
                                      int32_t width,
-                                     int32_t channels) -> void;
+                                     int32_t channels,
+                                     int32_t kernel_size,
+                                     int32_t stride,
+                                     int32_t blocked) -> void;
   auto depthwise_convolution_backward(float const *__restrict__ d_y,
                                       float *__restrict__ d_x,
                                       float *__restrict__ d_k,
                                       [[maybe_unused]] float *__restrict__ d_b,
                                       float const *__restrict__ k,
                                       float const *__restrict__ x,
+                                      float *__restrict__ row_buffer,
+                                      float *__restrict__ gradient_row_buffer,
                                       int32_t height,
                                       int32_t width,
-                                      int32_t channels) -> void;
+                                      int32_t channels,
+                                      int32_t kernel_size,
+                                      int32_t stride,
+                                      int32_t blocked,
+                                      int32_t accumulate) -> void;
+  auto depthwise_convolution_forward_bf16(bfloat16 const *__restrict__ x,
+                                          float *__restrict__ y,
+                                          float const *__restrict__ k,
+                                          [[maybe_unused]] float const *__restrict__ b,
+                                          float *__restrict__ row_buffer,
+                                          float *__restrict__ sum,
+                                          float *__restrict__ sum_of_squares,
+                                          int32_t height,
+                                          int32_t width,
+                                          int32_t channels,
+                                          int32_t kernel_size,
+                                          int32_t stride,
+                                          int32_t blocked) -> void;
+  auto depthwise_convolution_backward_bf16(float const *__restrict__ d_y,
+                                           float *__restrict__ d_x,
+                                           float *__restrict__ d_k,
+                                           [[maybe_unused]] float *__restrict__ d_b,
+                                           float const *__restrict__ k,
+                                           bfloat16 const *__restrict__ x,
+                                           float *__restrict__ row_buffer,
+                                           float *__restrict__ gradient_row_buffer,
+                                           int32_t height,
+                                           int32_t width,
+                                           int32_t channels,
+                                           int32_t kernel_size,
+                                           int32_t stride,
+                                           int32_t blocked,
+                                           int32_t accumulate) -> void;
+
+  auto inverted_residual_block_forward(float const *__restrict__ x,
+                                       float *__restrict__ y,
+                                       float const *__restrict__ expansion_packed_kernel,
+                                       float const *__restrict__ expansion_bias,
+                                       float const *__restrict__ depthwise_kernel,
+                                       float const *__restrict__ gamma,
+                                       float const *__restrict__ beta,
+                                       float const *__restrict__ reduction_kernel,
+                                       float const *__restrict__ reduction_bias,
+                                       float *__restrict__ depthwise_y,
+                                       float *__restrict__ row_buffer,
+                                       float *__restrict__ scratch,
+                                       float epsilon,
+                                       int32_t height,
+                                       int32_t width,
+                                       int32_t channels,
+                                       int32_t channels_expanded,
+                                       int32_t kernel_size) -> void;
+
+  auto quantize_pointwise_convolution_kernel(float const *__restrict__ kernel,
+                                             int8_t *__restrict__ packed_kernel,
+                                             float *__restrict__ kernel_scales,
+                                             int32_t channels_in,
+                                             int32_t channels_out) -> void;
+  auto quantized_pointwise_convolution_forward(float const *__restrict__ in,
+                                               float *__restrict__ out,
+                                               int8_t const *__restrict__ packed_kernel,
+                                               float const *__restrict__ kernel_scales,
+                                               float const *__restrict__ bias,
+                                               int8_t *__restrict__ scratch,
+                                               float input_scale,
+                                               int32_t height,
+                                               int32_t width,
+                                               int32_t channels_in,
+                                               int32_t channels_out,
+                                               int32_t hard_swish) -> void;
+  auto quantized_pointwise_convolution_pixel_shuffle_argmax(float const *__restrict__ in,
+                                                            int8_t const *__restrict__ packed_kernel,
+                                                            float const *__restrict__ kernel_scales,
+                                                            float const *__restrict__ bias,
+                                                            float *__restrict__ scratch,
+                                                            float *__restrict__ peak_values,
+                                                            int32_t *__restrict__ peak_indices,
+                                                            float input_scale,
+                                                            int32_t height,
+                                                            int32_t width,
+                                                            int32_t channels_in,
+                                                            int32_t channels_out,
+                                                            int32_t within_circle) -> void;
+  auto quantize_depthwise_convolution_kernel(float const *__restrict__ kernel,
+                                             int8_t *__restrict__ packed_kernel,
+                                             float *__restrict__ kernel_scales,
+                                             int32_t channels,
+                                             int32_t kernel_size) -> void;
+  auto quantized_inverted_residual_block_forward(float const *__restrict__ x,
+                                                 float *__restrict__ y,
+                                                 int8_t const *__restrict__ expansion_packed_kernel,
+                                                 float const *__restrict__ expansion_kernel_scales,
+                                                 float const *__restrict__ expansion_bias,
+                                                 int8_t const *__restrict__ depthwise_packed_kernel,
+                                                 float const *__restrict__ depthwise_kernel_scales,
+                                                 float const *__restrict__ gamma,
+                                                 float const *__restrict__ beta,
+                                                 int8_t const *__restrict__ reduction_packed_kernel,
+                                                 float const *__restrict__ reduction_kernel_scales,
+                                                 float const *__restrict__ reduction_bias,
+                                                 float *__restrict__ depthwise_y,
+                                                 int8_t *__restrict__ row_buffer,
+                                                 float *__restrict__ scratch,
+                                                 float input_scale,
+                                                 float expanded_scale,
+                                                 float normalized_scale,
+                                                 float epsilon,
+                                                 int32_t height,
+                                                 int32_t width,
+                                                 int32_t channels,
+                                                 int32_t channels_expanded,
+                                                 int32_t kernel_size) -> void;
+  auto max_abs(float const *__restrict__ x,
+               int32_t size) -> float;
+  auto max_abs_bf16(bfloat16 const *__restrict__ x,
+                    int32_t size) -> float;
 
   auto mean_squared_error_forward(float const *__restrict__ x_pred,
                                   float const *__restrict__ x_true,
                                   int32_t size) -> float;
-  auto mean_squared_error_backward(float d_y,
-                                   float *__restrict__ d_x,
-                                   float const *__restrict__ x_pred,
-                                   float const *__restrict__ x_true,
-                                   int32_t size) -> void;
+  auto mean_squared_error_forward_backward(float const *__restrict__ x_pred,
+                                           float const *__restrict__ x_true,
+                                           float *__restrict__ d_x,
+                                           int32_t size,
+                                           float d_y,
+                                           int32_t loss_weighted) -> float;
 
-  auto update_parameters(float const *__restrict__ gradients,
+  auto update_parameters(float *__restrict__ gradients,
                          float *__restrict__ parameters,
                          float *__restrict__ m,
                          float *__restrict__ v,
@@ -184,10 +443,25 @@ extern "C"
                          float beta_1,
                          float beta_2,
                          float epsilon,
-                         [[maybe_unused]] float schedule_multiplier,
+                         float schedule_multiplier,
                          float learning_rate,
-                         [[maybe_unused]] float weight_decay,
+                         float weight_decay,
                          int32_t t) -> void;
+  auto update_pointwise_convolution_kernel(float *__restrict__ gradients,
+                                           float *__restrict__ kernel,
+                                           float *__restrict__ m,
+                                           float *__restrict__ v,
+                                           float *__restrict__ packed_kernel,
+                                           float *__restrict__ packed_kernel_transposed,
+                                           int32_t channels_in,
+                                           int32_t channels_out,
+                                           float beta_1,
+                                           float beta_2,
+                                           float epsilon,
+                                           float schedule_multiplier,
+                                           float learning_rate,
+                                           float weight_decay,
+                                           int32_t t) -> void;
 
   auto draw_gaussians(float *__restrict__ data,
                       int32_t height,
@@ -195,6 +469,21 @@ extern "C"
                       int32_t channels,
                       float const *__restrict__ coords,
                       float sigma) -> void;
+  auto sparse_mean_squared_error_forward_backward(float const *__restrict__ x_pred,
+                                                  float const *__restrict__ x_true,
+                                                  float *__restrict__ d_x,
+                                                  float const *__restrict__ coords,
+                                                  int32_t const *__restrict__ samples,
+                                                  int32_t sample_count,
+                                                  int32_t *__restrict__ rows,
+                                                  int32_t *__restrict__ row_count,
+                                                  int32_t *__restrict__ row_flags,
+                                                  int32_t height,
+                                                  int32_t width,
+                                                  int32_t channels,
+                                                  float sigma,
+                                                  float d_y,
+                                                  int32_t loss_weighted) -> float;
 
   auto rgb_to_gray(float const *__restrict__ x,
                    float *__restrict__ y,
@@ -208,6 +497,13 @@ extern "C"
                                    int32_t y_height,
                                    int32_t y_width) -> void;
 
+  auto resize_bilinear_rgba(uint8_t const *__restrict__ x,
+                            uint8_t *__restrict__ y,
+                            int32_t x_height,
+                            int32_t x_width,
+                            int32_t y_height,
+                            int32_t y_width) -> void;
+
   auto rotate_bilinear(float const *__restrict__ original,
                        float *__restrict__ rotated,
                        int32_t height,
@@ -250,6 +546,407 @@ namespace
     x = y;
     y = temp;
   }
+
+  auto load_lanes(float const *__restrict__ x, int32_t count) -> v128_t
+  {
+    if (count >= 4)
+    {
+      return wasm_v128_load(x);
+    }
+
+    float temp[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    for (int32_t i = 0; i < count; ++i)
+    {
+      temp[i] = x[i];
+    }
+    return wasm_v128_load(temp);
+  }
+
+  auto store_lanes(float *__restrict__ x, v128_t value, int32_t count) -> void
+  {
+    if (count >= 4)
+    {
+      wasm_v128_store(x, value);
+      return;
+    }
+
+    float temp[4];
+    wasm_v128_store(temp, value);
+    for (int32_t i = 0; i < count; ++i)
+    {
+      x[i] = temp[i];
+    }
+  }
+
+  auto multiply(float *__restrict__ x, int32_t size, float factor) -> void
+  {
+    v128_t factors = wasm_f32x4_splat(factor);
+    for (int32_t i = 0; i < size; i += 4)
+    {
+      store_lanes(x + i, wasm_f32x4_mul(load_lanes(x + i, size - i), factors), size - i);
+    }
+  }
+
+  auto to_float(float x) -> float
+  {
+    return x;
+  }
+
+  auto to_float(bfloat16 x) -> float
+  {
+    return __builtin_bit_cast(float, static_cast<uint32_t>(x.bits) << 16);
+  }
+
+  auto load_lanes(bfloat16 const *__restrict__ x, int32_t count) -> v128_t
+  {
+    if (count >= 4)
+    {
+      return wasm_i32x4_shl(wasm_u32x4_load16x4(x), 16);
+    }
+
+    bfloat16 temp[4] = {};
+    for (int32_t i = 0; i < count; ++i)
+    {
+      temp[i] = x[i];
+    }
+    return wasm_i32x4_shl(wasm_u32x4_load16x4(temp), 16);
+  }
+
+  auto store_lanes(bfloat16 *__restrict__ x, v128_t value, int32_t count) -> void
+  {
+    // Rounds to nearest with ties to even: adding 0x7fff, plus 1 when the kept half is odd, carries into the kept
+    // half exactly when the dropped half is above one half, or is one half and the kept half is odd.
+    v128_t rounding = wasm_i32x4_add(wasm_i32x4_splat(0x7fff), wasm_v128_and(wasm_u32x4_shr(value, 16), wasm_i32x4_splat(1)));
+    v128_t bits = wasm_u32x4_shr(wasm_i32x4_add(value, rounding), 16);
+    v128_t narrowed = wasm_u16x8_narrow_i32x4(bits, bits);
+    if (count >= 4)
+    {
+      wasm_v128_store64_lane(x, narrowed, 0);
+      return;
+    }
+
+    bfloat16 temp[8];
+    wasm_v128_store(temp, narrowed);
+    for (int32_t i = 0; i < count; ++i)
+    {
+      x[i] = temp[i];
+    }
+  }
+
+  // A parameter of type type_identity_t<T> takes no part in deducing T, so a null pointer can be passed for an
+  // optional buffer whose element type follows from another argument.
+  template <typename T>
+  struct type_identity
+  {
+    using type = T;
+  };
+
+  template <typename T>
+  using type_identity_t = typename type_identity<T>::type;
+
+  // x * relu6(x + 3) / 6, which matches the piecewise definition used by hard_swish_forward.
+  auto hard_swish(v128_t x) -> v128_t
+  {
+    v128_t gate = wasm_f32x4_min(wasm_f32x4_max(wasm_f32x4_add(x, wasm_f32x4_splat(3.0f)), wasm_f32x4_splat(0.0f)), wasm_f32x4_splat(6.0f));
+    return wasm_f32x4_mul(x, wasm_f32x4_mul(gate, wasm_f32x4_splat(1.0f / 6.0f)));
+  }
+
+  auto hard_swish_derivative(v128_t x) -> v128_t
+  {
+    v128_t derivative = wasm_f32x4_mul(wasm_f32x4_add(wasm_f32x4_add(x, x), wasm_f32x4_splat(3.0f)), wasm_f32x4_splat(1.0f / 6.0f));
+    derivative = wasm_v128_bitselect(wasm_f32x4_splat(0.0f), derivative, wasm_f32x4_le(x, wasm_f32x4_splat(-3.0f)));
+    return wasm_v128_bitselect(wasm_f32x4_splat(1.0f), derivative, wasm_f32x4_ge(x, wasm_f32x4_splat(3.0f)));
+  }
+
+#ifdef IMPORTED_MATH
+  // Reference implementations that call the JavaScript Math functions one lane at a time, selected with
+  // -DIMPORTED_MATH to check the polynomial versions against.
+  auto exp_f32x4(v128_t x) -> v128_t
+  {
+    return wasm_f32x4_make(exp(wasm_f32x4_extract_lane(x, 0)),
+                           exp(wasm_f32x4_extract_lane(x, 1)),
+                           exp(wasm_f32x4_extract_lane(x, 2)),
+                           exp(wasm_f32x4_extract_lane(x, 3)));
+  }
+
+  auto pow_f32x4(v128_t x, float exponent) -> v128_t
+  {
+    x = wasm_f32x4_max(x, wasm_f32x4_splat(0.0f));
+    return wasm_f32x4_make(pow(wasm_f32x4_extract_lane(x, 0), exponent),
+                           pow(wasm_f32x4_extract_lane(x, 1), exponent),
+                           pow(wasm_f32x4_extract_lane(x, 2), exponent),
+                           pow(wasm_f32x4_extract_lane(x, 3), exponent));
+  }
+
+  auto sin_cos_f32x4(v128_t x, v128_t &sine, v128_t &cosine) -> void
+  {
+    sine = wasm_f32x4_make(sin(wasm_f32x4_extract_lane(x, 0)),
+                           sin(wasm_f32x4_extract_lane(x, 1)),
+                           sin(wasm_f32x4_extract_lane(x, 2)),
+                           sin(wasm_f32x4_extract_lane(x, 3)));
+    cosine = wasm_f32x4_make(cos(wasm_f32x4_extract_lane(x, 0)),
+                             cos(wasm_f32x4_extract_lane(x, 1)),
+                             cos(wasm_f32x4_extract_lane(x, 2)),
+                             cos(wasm_f32x4_extract_lane(x, 3)));
+  }
+#else
+  // e^x as 2^n * e^r with |r| <= ln(2) / 2, where e^r is a degree 6 polynomial (the Cephes expf coefficients).
+  // Relative error is below 1.5e-7 (about 1 ulp) for x in [-87, 88]. Results below 2^-126 flush to 0, and
+  // x above 88.7 saturates at about 3.4e38 rather than overflowing to infinity.
+  auto exp_f32x4(v128_t x) -> v128_t
+  {
+    v128_t underflow = wasm_f32x4_lt(x, wasm_f32x4_splat(-87.33654f));
+    x = wasm_f32x4_min(wasm_f32x4_max(x, wasm_f32x4_splat(-87.33654f)), wasm_f32x4_splat(88.72283f));
+
+    // n * ln(2) is subtracted in two parts so that r keeps the low bits of x.
+    v128_t n = wasm_f32x4_nearest(wasm_f32x4_mul(x, wasm_f32x4_splat(1.44269504f)));
+    v128_t r = wasm_f32x4_sub(x, wasm_f32x4_mul(n, wasm_f32x4_splat(0.693359375f)));
+    r = wasm_f32x4_sub(r, wasm_f32x4_mul(n, wasm_f32x4_splat(-2.12194440e-4f)));
+
+    v128_t p = wasm_f32x4_splat(1.9875691500e-4f);
+    p = wasm_f32x4_add(wasm_f32x4_mul(p, r), wasm_f32x4_splat(1.3981999507e-3f));
+    p = wasm_f32x4_add(wasm_f32x4_mul(p, r), wasm_f32x4_splat(8.3334519073e-3f));
+    p = wasm_f32x4_add(wasm_f32x4_mul(p, r), wasm_f32x4_splat(4.1665795894e-2f));
+    p = wasm_f32x4_add(wasm_f32x4_mul(p, r), wasm_f32x4_splat(1.6666665459e-1f));
+    p = wasm_f32x4_add(wasm_f32x4_mul(p, r), wasm_f32x4_splat(5.0000001201e-1f));
+    p = wasm_f32x4_add(wasm_f32x4_add(wasm_f32x4_mul(p, wasm_f32x4_mul(r, r)), r), wasm_f32x4_splat(1.0f));
+
+    // 2^n is built directly in the exponent bits; n is within [-126, 128) after the clamp above, and the top
+    // end is split across two factors so that 2^128 never has to be represented.
+    v128_t n_i = wasm_i32x4_trunc_sat_f32x4(n);
+    v128_t half_n_i = wasm_i32x4_shr(n_i, 1);
+    v128_t scale_0 = wasm_i32x4_shl(wasm_i32x4_add(half_n_i, wasm_i32x4_splat(127)), 23);
+    v128_t scale_1 = wasm_i32x4_shl(wasm_i32x4_add(wasm_i32x4_sub(n_i, half_n_i), wasm_i32x4_splat(127)), 23);
+    v128_t result = wasm_f32x4_mul(wasm_f32x4_mul(p, scale_0), scale_1);
+
+    return wasm_v128_andnot(result, underflow);
+  }
+
+  // log(x) for positive normal x, as e * ln(2) + log(m) with m in [sqrt(1/2), sqrt(2)) and log(m) a degree 9
+  // polynomial in m - 1 (the Cephes logf coefficients). Absolute error is below 5e-8 for x near 1 and relative
+  // error below 1e-7 elsewhere.
+  auto log_f32x4(v128_t x) -> v128_t
+  {
+    v128_t e = wasm_i32x4_sub(wasm_u32x4_shr(x, 23), wasm_i32x4_splat(126));
+    v128_t m = wasm_v128_or(wasm_v128_and(x, wasm_i32x4_splat(0x007fffff)), wasm_i32x4_splat(0x3f000000));
+
+    // m is now in [1/2, 1); values below sqrt(1/2) are doubled so m - 1 stays small.
+    v128_t small = wasm_f32x4_lt(m, wasm_f32x4_splat(0.707106781f));
+    e = wasm_i32x4_add(e, small);
+    m = wasm_f32x4_sub(wasm_f32x4_add(m, wasm_v128_and(m, small)), wasm_f32x4_splat(1.0f));
+    v128_t e_f = wasm_f32x4_convert_i32x4(e);
+
+    v128_t z = wasm_f32x4_mul(m, m);
+    v128_t p = wasm_f32x4_splat(7.0376836292e-2f);
+    p = wasm_f32x4_add(wasm_f32x4_mul(p, m), wasm_f32x4_splat(-1.1514610310e-1f));
+    p = wasm_f32x4_add(wasm_f32x4_mul(p, m), wasm_f32x4_splat(1.1676998740e-1f));
+    p = wasm_f32x4_add(wasm_f32x4_mul(p, m), wasm_f32x4_splat(-1.2420140846e-1f));
+    p = wasm_f32x4_add(wasm_f32x4_mul(p, m), wasm_f32x4_splat(1.4249322787e-1f));
+    p = wasm_f32x4_add(wasm_f32x4_mul(p, m), wasm_f32x4_splat(-1.6668057665e-1f));
+    p = wasm_f32x4_add(wasm_f32x4_mul(p, m), wasm_f32x4_splat(2.0000714765e-1f));
+    p = wasm_f32x4_add(wasm_f32x4_mul(p, m), wasm_f32x4_splat(-2.4999993993e-1f));
+    p = wasm_f32x4_add(wasm_f32x4_mul(p, m), wasm_f32x4_splat(3.3333331174e-1f));
+    p = wasm_f32x4_mul(wasm_f32x4_mul(p, m), z);
+
+    p = wasm_f32x4_add(p, wasm_f32x4_mul(e_f, wasm_f32x4_splat(-2.12194440e-4f)));
+    p = wasm_f32x4_sub(p, wasm_f32x4_mul(z, wasm_f32x4_splat(0.5f)));
+    return wasm_f32x4_add(wasm_f32x4_add(m, p), wasm_f32x4_mul(e_f, wasm_f32x4_splat(0.693359375f)));
+  }
+
+  // x^exponent as e^(exponent * log(x)) for a positive exponent. x at or below the smallest normal float,
+  // including negative x, gives 0. The relative error of log is multiplied by |exponent * log(x)|, so it stays
+  // within about 1e-6 for x in [2^-10, 2^10] and exponents near 1, which covers gamma augmentation of pixels.
+  auto pow_f32x4(v128_t x, float exponent) -> v128_t
+  {
+    v128_t zero = wasm_f32x4_lt(x, wasm_f32x4_splat(FLT_MIN));
+    v128_t result = exp_f32x4(wasm_f32x4_mul(wasm_f32x4_splat(exponent), log_f32x4(x)));
+    return wasm_v128_andnot(result, zero);
+  }
+
+  // sin(x) and cos(x) together, reducing x by the nearest multiple of pi / 2 (subtracted in three parts) and
+  // evaluating the Cephes sinf and cosf polynomials on the remainder in [-pi / 4, pi / 4]. Absolute error is
+  // below 1.5e-7 for |x| up to a few thousand, far beyond the angles used for augmentation.
+  auto sin_cos_f32x4(v128_t x, v128_t &sine, v128_t &cosine) -> void
+  {
+    v128_t q = wasm_f32x4_nearest(wasm_f32x4_mul(x, wasm_f32x4_splat(0.636619772f)));
+    v128_t r = wasm_f32x4_sub(x, wasm_f32x4_mul(q, wasm_f32x4_splat(1.5703125f)));
+    r = wasm_f32x4_sub(r, wasm_f32x4_mul(q, wasm_f32x4_splat(4.837512969970703125e-4f)));
+    r = wasm_f32x4_sub(r, wasm_f32x4_mul(q, wasm_f32x4_splat(7.54978995489188216e-8f)));
+    v128_t z = wasm_f32x4_mul(r, r);
+
+    v128_t s = wasm_f32x4_splat(-1.9515295891e-4f);
+    s = wasm_f32x4_add(wasm_f32x4_mul(s, z), wasm_f32x4_splat(8.3321608736e-3f));
+    s = wasm_f32x4_add(wasm_f32x4_mul(s, z), wasm_f32x4_splat(-1.6666654611e-1f));
+    s = wasm_f32x4_add(wasm_f32x4_mul(wasm_f32x4_mul(s, z), r), r);
+
+    v128_t c = wasm_f32x4_splat(2.443315711809948e-5f);
+    c = wasm_f32x4_add(wasm_f32x4_mul(c, z), wasm_f32x4_splat(-1.388731625493765e-3f));
+    c = wasm_f32x4_add(wasm_f32x4_mul(c, z), wasm_f32x4_splat(4.166664568298827e-2f));
+    c = wasm_f32x4_mul(wasm_f32x4_mul(c, z), z);
+    c = wasm_f32x4_add(wasm_f32x4_sub(c, wasm_f32x4_mul(z, wasm_f32x4_splat(0.5f))), wasm_f32x4_splat(1.0f));
+
+    // Quadrant q maps (sin, cos) of r to (s, c), (c, -s), (-s, -c) or (-c, s).
+    v128_t q_i = wasm_i32x4_trunc_sat_f32x4(q);
+    v128_t swap = wasm_i32x4_eq(wasm_v128_and(q_i, wasm_i32x4_splat(1)), wasm_i32x4_splat(1));
+    v128_t sine_sign = wasm_i32x4_shl(wasm_v128_and(q_i, wasm_i32x4_splat(2)), 30);
+    v128_t cosine_sign = wasm_i32x4_shl(wasm_v128_and(wasm_i32x4_add(q_i, wasm_i32x4_splat(1)), wasm_i32x4_splat(2)), 30);
+    sine = wasm_v128_xor(wasm_v128_bitselect(c, s, swap), sine_sign);
+    cosine = wasm_v128_xor(wasm_v128_bitselect(s, c, swap), cosine_sign);
+  }
+#endif
+
+  // base^exponent for an integer exponent, by repeated squaring.
+  auto power(float base, int32_t exponent) -> float
+  {
+    float result = 1.0f;
+    for (; exponent > 0; exponent >>= 1)
+    {
+      if (exponent & 1)
+      {
+        result *= base;
+      }
+      base *= base;
+    }
+    return result;
+  }
+
+  // Activations are either NHWC or channel-blocked NHWc4, where the channels are split into blocks of 4 and
+  // every block is stored as its own height x width x 4 plane, so each pixel of a block is one whole v128.
+  // Lanes of the last block past the channel count are never read as channels and hold unspecified values.
+  struct tensor_layout
+  {
+    int32_t pixel_stride;
+    int32_t block_stride;
+
+    constexpr auto offset(int32_t pixel, int32_t channel) const -> int32_t
+    {
+      return pixel * pixel_stride + (channel / 4) * block_stride + channel % 4;
+    }
+  };
+
+  constexpr auto nhwc_layout(int32_t channels) -> tensor_layout
+  {
+    return {channels, 4};
+  }
+
+  constexpr auto make_tensor_layout(int32_t blocked, int32_t size, int32_t channels) -> tensor_layout
+  {
+    return blocked ? tensor_layout{4, size * 4} : nhwc_layout(channels);
+  }
+
+  // One step of AdamW with decoupled weight decay. The bias corrections are folded into the step size and the
+  // second moment scale once per update, so each parameter costs a square root and a divide.
+  struct adamw_step
+  {
+    v128_t beta_1;
+    v128_t beta_2;
+    v128_t one_minus_beta_1;
+    v128_t one_minus_beta_2;
+    v128_t step_size;
+    v128_t second_moment_scale;
+    v128_t epsilon;
+    v128_t decay;
+  };
+
+  auto make_adamw_step(float beta_1,
+                       float beta_2,
+                       float epsilon,
+                       float schedule_multiplier,
+                       float learning_rate,
+                       float weight_decay,
+                       int32_t t) -> adamw_step
+  {
+    return {wasm_f32x4_splat(beta_1),
+            wasm_f32x4_splat(beta_2),
+            wasm_f32x4_splat(1.0f - beta_1),
+            wasm_f32x4_splat(1.0f - beta_2),
+            wasm_f32x4_splat(schedule_multiplier * learning_rate / (1.0f - power(beta_1, t))),
+            wasm_f32x4_splat(1.0f / (1.0f - power(beta_2, t))),
+            wasm_f32x4_splat(epsilon),
+            wasm_f32x4_splat(1.0f - schedule_multiplier * weight_decay)};
+  }
+
+  // Updates up to 4 parameters and their moments, zeroes the gradients they consumed and returns the new
+  // parameters.
+  auto adamw_update(adamw_step const &step,
+                    float *__restrict__ gradients,
+                    float *__restrict__ parameters,
+                    float *__restrict__ m,
+                    float *__restrict__ v,
+                    int32_t lanes) -> v128_t
+  {
+    v128_t g = load_lanes(gradients, lanes);
+    v128_t m_i = wasm_f32x4_add(wasm_f32x4_mul(step.beta_1, load_lanes(m, lanes)), wasm_f32x4_mul(step.one_minus_beta_1, g));
+    v128_t v_i = wasm_f32x4_add(wasm_f32x4_mul(step.beta_2, load_lanes(v, lanes)), wasm_f32x4_mul(step.one_minus_beta_2, wasm_f32x4_mul(g, g)));
+    store_lanes(m, m_i, lanes);
+    store_lanes(v, v_i, lanes);
+    store_lanes(gradients, wasm_f32x4_splat(0.0f), lanes);
+
+    v128_t denominator = wasm_f32x4_add(wasm_f32x4_sqrt(wasm_f32x4_mul(v_i, step.second_moment_scale)), step.epsilon);
+    v128_t p = wasm_f32x4_mul(load_lanes(parameters, lanes), step.decay);
+    p = wasm_f32x4_sub(p, wasm_f32x4_div(wasm_f32x4_mul(step.step_size, m_i), denominator));
+    store_lanes(parameters, p, lanes);
+    return p;
+  }
+
+  template <int32_t... values>
+  struct integer_sequence
+  {
+  };
+
+  template <int32_t count, int32_t... values>
+  struct integer_sequence_builder
+  {
+    using type = typename integer_sequence_builder<count - 1, count - 1, values...>::type;
+  };
+
+  template <int32_t... values>
+  struct integer_sequence_builder<0, values...>
+  {
+    using type = integer_sequence<values...>;
+  };
+
+  int32_t constexpr channel_table_step = 8;
+  int32_t constexpr channel_table_max = 192;
+
+  // Kernels templated on a channel count are instantiated for every multiple of channel_table_step up to
+  // channel_table_max. A fixed channel count of 0 is the runtime-width fallback used for every other width.
+  template <int32_t fixed_channels>
+  constexpr auto channel_count(int32_t channels) -> int32_t
+  {
+    return fixed_channels != 0 ? fixed_channels : channels;
+  }
+
+  template <typename Function>
+  struct channel_table
+  {
+    Function fixed[channel_table_max / channel_table_step];
+    Function generic;
+
+    constexpr auto operator[](int32_t channels) const -> Function
+    {
+      if (channels > 0 && channels <= channel_table_max && channels % channel_table_step == 0)
+      {
+        return fixed[channels / channel_table_step - 1];
+      }
+      return generic;
+    }
+  };
+
+  template <typename Instantiate, int32_t... indices>
+  constexpr auto make_channel_table(Instantiate instantiate, integer_sequence<indices...>)
+  {
+    using Function = decltype(instantiate.template operator()<0>());
+    return channel_table<Function>{{instantiate.template operator()<(indices + 1) * channel_table_step>()...},
+                                   instantiate.template operator()<0>()};
+  }
+
+  template <typename Instantiate>
+  constexpr auto make_channel_table(Instantiate instantiate)
+  {
+    using sequence = typename integer_sequence_builder<channel_table_max / channel_table_step>::type;
+    return make_channel_table(instantiate, sequence{});
+  }
 }
 
 auto add_forward(float const *__restrict__ x_1,
@@ -265,11 +962,12 @@ auto add_forward(float const *__restrict__ x_1,
 
 auto add_backward(float const *__restrict__ d_y,
                   float *__restrict__ d_x,
-                  int32_t size) -> void
+                  int32_t size,
+                  int32_t accumulate) -> void
 {
   for (int32_t i = 0; i < size; ++i)
   {
-    d_x[i] += d_y[i];
+    d_x[i] = accumulate ? d_x[i] + d_y[i] : d_y[i];
   }
 }
 
@@ -297,7 +995,8 @@ auto hard_swish_forward(float const *__restrict__ x,
 auto hard_swish_backward(float const *__restrict__ d_y,
                          float *__restrict__ d_x,
                          float const *__restrict__ x,
-                         int32_t size) -> void
+                         int32_t size,
+                         int32_t accumulate) -> void
 {
   for (int32_t i = 0; i < size; ++i)
   {
@@ -314,28 +1013,29 @@ auto hard_swish_backward(float const *__restrict__ d_y,
     {
       temp = (2.0f * x[i] + 3.0f) * (1.0f / 6.0f);
     }
-    d_x[i] += temp * d_y[i];
+    d_x[i] = accumulate ? d_x[i] + temp * d_y[i] : temp * d_y[i];
   }
 }
 
-template <int32_t x_c>
+template <int32_t fixed_x_c>
 auto dropout_forward_inner(float const *__restrict__ x,
                            float *__restrict__ y,
                            float const *__restrict__ mask,
                            int32_t x_h,
                            int32_t x_w,
+                           int32_t x_c,
                            float drop_prob) -> void
 {
-  for (int32_t h = 0; h < x_h; ++h)
+  x_c = channel_count<fixed_x_c>(x_c);
+
+  v128_t const keep_prob = wasm_f32x4_splat(1.0f - drop_prob);
+
+  for (int32_t i = 0; i < x_h * x_w; ++i)
   {
-    for (int32_t w = 0; w < x_w; ++w)
+    for (int32_t c = 0; c < x_c; c += 4)
     {
-      for (int32_t c = 0; c < x_c; ++c)
-      {
-        int32_t i = h * x_w * x_c + w * x_c + c;
-
-        y[i] = x[i] * mask[c] / (1.0 - drop_prob);
-      }
+      v128_t value = wasm_f32x4_mul(load_lanes(x + i * x_c + c, x_c - c), load_lanes(mask + c, x_c - c));
+      store_lanes(y + i * x_c + c, wasm_f32x4_div(value, keep_prob), x_c - c);
     }
   }
 }
@@ -348,45 +1048,38 @@ auto dropout_forward(float const *__restrict__ x,
                      int32_t x_c,
                      float drop_prob) -> void
 {
-  if (x_c == 2 * 16)
-  {
-    dropout_forward_inner<2 * 16>(x, y, mask, x_h, x_w, drop_prob);
-  }
-  else if (x_c == 2 * 24)
-  {
-    dropout_forward_inner<2 * 24>(x, y, mask, x_h, x_w, drop_prob);
-  }
-  else if (x_c == 2 * 32)
-  {
-    dropout_forward_inner<2 * 32>(x, y, mask, x_h, x_w, drop_prob);
-  }
-  else if (x_c == 2 * 40)
-  {
-    dropout_forward_inner<2 * 40>(x, y, mask, x_h, x_w, drop_prob);
-  }
-  else if (x_c == 2 * 48)
-  {
-    dropout_forward_inner<2 * 48>(x, y, mask, x_h, x_w, drop_prob);
-  }
+  static constexpr auto table = make_channel_table([]<int32_t fixed_x_c>()
+                                                   { return &dropout_forward_inner<fixed_x_c>; });
+  table[x_c](x,
+             y,
+             mask,
+             x_h,
+             x_w,
+             x_c,
+             drop_prob);
 }
 
-template <int32_t x_c>
+template <int32_t fixed_x_c>
 auto dropout_backward_inner(float const *__restrict__ d_y,
                             float *__restrict__ d_x,
                             float const *__restrict__ mask,
                             int32_t x_h,
-                            int32_t x_w) -> void
+                            int32_t x_w,
+                            int32_t x_c,
+                            int32_t accumulate) -> void
 {
-  for (int32_t h = 0; h < x_h; ++h)
+  x_c = channel_count<fixed_x_c>(x_c);
+
+  for (int32_t i = 0; i < x_h * x_w; ++i)
   {
-    for (int32_t w = 0; w < x_w; ++w)
+    for (int32_t c = 0; c < x_c; c += 4)
     {
-      for (int32_t c = 0; c < x_c; ++c)
+      v128_t value = wasm_f32x4_mul(load_lanes(d_y + i * x_c + c, x_c - c), load_lanes(mask + c, x_c - c));
+      if (accumulate)
       {
-        int32_t i = h * x_w * x_c + w * x_c + c;
-
-        d_x[i] += d_y[i] * mask[c];
+        value = wasm_f32x4_add(load_lanes(d_x + i * x_c + c, x_c - c), value);
       }
+      store_lanes(d_x + i * x_c + c, value, x_c - c);
     }
   }
 }
@@ -396,36 +1089,23 @@ auto dropout_backward(float const *__restrict__ d_y,
                       float const *__restrict__ mask,
                       int32_t x_h,
                       int32_t x_w,
-                      int32_t x_c) -> void
+                      int32_t x_c,
+                      int32_t accumulate) -> void
 {
-  if (x_c == 2 * 16)
-  {
-    dropout_backward_inner<2 * 16>(d_y, d_x, mask, x_h, x_w);
-  }
-  else if (x_c == 2 * 24)
-  {
-    dropout_backward_inner<2 * 24>(d_y, d_x, mask, x_h, x_w);
-  }
-  else if (x_c == 2 * 32)
-  {
-    dropout_backward_inner<2 * 32>(d_y, d_x, mask, x_h, x_w);
-  }
-  else if (x_c == 2 * 40)
-  {
-    dropout_backward_inner<2 * 40>(d_y, d_x, mask, x_h, x_w);
-  }
-  else if (x_c == 2 * 48)
-  {
-    dropout_backward_inner<2 * 48>(d_y, d_x, mask, x_h, x_w);
-  }
+  static constexpr auto table = make_channel_table([]<int32_t fixed_x_c>()
+                                                   { return &dropout_backward_inner<fixed_x_c>; });
+  table[x_c](d_y, d_x, mask, x_h, x_w, x_c, accumulate);
 }
 
-template <int32_t x_c>
+template <int32_t fixed_x_c>
 auto pixel_unshuffle_forward_inner(float const *__restrict__ x,
                                    float *__restrict__ y,
                                    int32_t x_h,
-                                   int32_t x_w) -> void
+                                   int32_t x_w,
+                                   int32_t x_c) -> void
 {
+  x_c = channel_count<fixed_x_c>(x_c);
+
   int32_t constexpr scale = 8;
 
   for (int32_t h = 0; h < x_h * scale; ++h)
@@ -454,22 +1134,21 @@ auto pixel_unshuffle_forward(float const *__restrict__ x,
                              int32_t x_w,
                              int32_t x_c) -> void
 {
-  if (x_c == 8 * 8 * 1)
-  {
-    pixel_unshuffle_forward_inner<8 * 8 * 1>(x, y, x_h, x_w);
-  }
-  else if (x_c == 8 * 8 * 3)
-  {
-    pixel_unshuffle_forward_inner<8 * 8 * 3>(x, y, x_h, x_w);
-  }
+  static constexpr auto table = make_channel_table([]<int32_t fixed_x_c>()
+                                                   { return &pixel_unshuffle_forward_inner<fixed_x_c>; });
+  table[x_c](x, y, x_h, x_w, x_c);
 }
 
-template <int32_t x_c>
+template <int32_t fixed_x_c>
 auto pixel_unshuffle_backward_inner(float const *__restrict__ d_y,
                                     float *__restrict__ d_x,
                                     int32_t x_h,
-                                    int32_t x_w) -> void
+                                    int32_t x_w,
+                                    int32_t x_c,
+                                    int32_t accumulate) -> void
 {
+  x_c = channel_count<fixed_x_c>(x_c);
+
   int32_t constexpr scale = 8;
 
   for (int32_t h = 0; h < x_h * scale; ++h)
@@ -486,7 +1165,7 @@ auto pixel_unshuffle_backward_inner(float const *__restrict__ d_y,
         d_x_i += w * (x_c / square(scale));
         d_x_i += c;
 
-        d_x[d_x_i] += d_y[d_y_i];
+        d_x[d_x_i] = accumulate ? d_x[d_x_i] + d_y[d_y_i] : d_y[d_y_i];
       }
     }
   }
@@ -496,24 +1175,23 @@ auto pixel_unshuffle_backward(float const *__restrict__ d_y,
                               float *__restrict__ d_x,
                               int32_t x_h,
                               int32_t x_w,
-                              int32_t x_c) -> void
+                              int32_t x_c,
+                              int32_t accumulate) -> void
 {
-  if (x_c == 8 * 8 * 1)
-  {
-    pixel_unshuffle_backward_inner<8 * 8 * 1>(d_y, d_x, x_h, x_w);
-  }
-  else if (x_c == 8 * 8 * 3)
-  {
-    pixel_unshuffle_backward_inner<8 * 8 * 3>(d_y, d_x, x_h, x_w);
-  }
+  static constexpr auto table = make_channel_table([]<int32_t fixed_x_c>()
+                                                   { return &pixel_unshuffle_backward_inner<fixed_x_c>; });
+  table[x_c](d_y, d_x, x_h, x_w, x_c, accumulate);
 }
 
-template <int32_t x_c>
+template <int32_t fixed_x_c>
 auto pixel_shuffle_forward_inner(float const *__restrict__ x,
                                  float *__restrict__ y,
                                  int32_t x_h,
-                                 int32_t x_w) -> void
+                                 int32_t x_w,
+                                 int32_t x_c) -> void
 {
+  x_c = channel_count<fixed_x_c>(x_c);
+
   int32_t constexpr scale = 4;
 
   for (int32_t h = 0; h < x_h * scale; ++h)
@@ -542,54 +1220,21 @@ auto pixel_shuffle_forward(float const *__restrict__ x,
                            int32_t x_w,
                            int32_t x_c) -> void
 {
-  if (x_c == 4 * 4 * 1)
-  {
-    pixel_shuffle_forward_inner<4 * 4 * 1>(x, y, x_h, x_w);
-  }
-  else if (x_c == 4 * 4 * 2)
-  {
-    pixel_shuffle_forward_inner<4 * 4 * 2>(x, y, x_h, x_w);
-  }
-  else if (x_c == 4 * 4 * 3)
-  {
-    pixel_shuffle_forward_inner<4 * 4 * 3>(x, y, x_h, x_w);
-  }
-  else if (x_c == 4 * 4 * 4)
-  {
-    pixel_shuffle_forward_inner<4 * 4 * 4>(x, y, x_h, x_w);
-  }
-  else if (x_c == 4 * 4 * 5)
-  {
-    pixel_shuffle_forward_inner<4 * 4 * 5>(x, y, x_h, x_w);
-  }
-  else if (x_c == 4 * 4 * 6)
-  {
-    pixel_shuffle_forward_inner<4 * 4 * 6>(x, y, x_h, x_w);
-  }
-  else if (x_c == 4 * 4 * 7)
-  {
-    pixel_shuffle_forward_inner<4 * 4 * 7>(x, y, x_h, x_w);
-  }
-  else if (x_c == 4 * 4 * 8)
-  {
-    pixel_shuffle_forward_inner<4 * 4 * 8>(x, y, x_h, x_w);
-  }
-  else if (x_c == 4 * 4 * 9)
-  {
-    pixel_shuffle_forward_inner<4 * 4 * 9>(x, y, x_h, x_w);
-  }
-  else if (x_c == 4 * 4 * 10)
-  {
-    pixel_shuffle_forward_inner<4 * 4 * 10>(x, y, x_h, x_w);
-  }
+  static constexpr auto table = make_channel_table([]<int32_t fixed_x_c>()
+                                                   { return &pixel_shuffle_forward_inner<fixed_x_c>; });
+  table[x_c](x, y, x_h, x_w, x_c);
 }
 
-template <int32_t x_c>
+template <int32_t fixed_x_c>
 auto pixel_shuffle_backward_inner(float const *__restrict__ d_y,
                                   float *__restrict__ d_x,
                                   int32_t x_h,
-                                  int32_t x_w) -> void
+                                  int32_t x_w,
+                                  int32_t x_c,
+                                  int32_t accumulate) -> void
 {
+  x_c = channel_count<fixed_x_c>(x_c);
+
   int32_t constexpr scale = 4;
 
   for (int32_t h = 0; h < x_h * scale; ++h)
@@ -606,7 +1251,7 @@ auto pixel_shuffle_backward_inner(float const *__restrict__ d_y,
         d_x_i += (w / scale) * x_c;
         d_x_i += c * scale * scale + (h % scale) * scale + (w % scale);
 
-        d_x[d_x_i] += d_y[d_y_i];
+        d_x[d_x_i] = accumulate ? d_x[d_x_i] + d_y[d_y_i] : d_y[d_y_i];
       }
     }
   }
@@ -616,122 +1261,162 @@ auto pixel_shuffle_backward(float const *__restrict__ d_y,
                             float *__restrict__ d_x,
                             int32_t x_h,
                             int32_t x_w,
-                            int32_t x_c) -> void
+                            int32_t x_c,
+                            int32_t accumulate) -> void
 {
-  if (x_c == 4 * 4 * 1)
-  {
-    pixel_shuffle_backward_inner<4 * 4 * 1>(d_y, d_x, x_h, x_w);
-  }
-  else if (x_c == 4 * 4 * 2)
-  {
-    pixel_shuffle_backward_inner<4 * 4 * 2>(d_y, d_x, x_h, x_w);
-  }
-  else if (x_c == 4 * 4 * 3)
-  {
-    pixel_shuffle_backward_inner<4 * 4 * 3>(d_y, d_x, x_h, x_w);
-  }
-  else if (x_c == 4 * 4 * 4)
-  {
-    pixel_shuffle_backward_inner<4 * 4 * 4>(d_y, d_x, x_h, x_w);
-  }
-  else if (x_c == 4 * 4 * 5)
-  {
-    pixel_shuffle_backward_inner<4 * 4 * 5>(d_y, d_x, x_h, x_w);
-  }
-  else if (x_c == 4 * 4 * 6)
-  {
-    pixel_shuffle_backward_inner<4 * 4 * 6>(d_y, d_x, x_h, x_w);
-  }
-  else if (x_c == 4 * 4 * 7)
-  {
-    pixel_shuffle_backward_inner<4 * 4 * 7>(d_y, d_x, x_h, x_w);
-  }
-  else if (x_c == 4 * 4 * 8)
-  {
-    pixel_shuffle_backward_inner<4 * 4 * 8>(d_y, d_x, x_h, x_w);
-  }
-  else if (x_c == 4 * 4 * 9)
-  {
-    pixel_shuffle_backward_inner<4 * 4 * 9>(d_y, d_x, x_h, x_w);
-  }
-  else if (x_c == 4 * 4 * 10)
-  {
-    pixel_shuffle_backward_inner<4 * 4 * 10>(d_y, d_x, x_h, x_w);
-  }
+  static constexpr auto table = make_channel_table([]<int32_t fixed_x_c>()
+                                                   { return &pixel_shuffle_backward_inner<fixed_x_c>; });
+  table[x_c](d_y, d_x, x_h, x_w, x_c, accumulate);
 }
 
-template <int32_t x_c>
-auto instance_normalization_forward_inner(float const *__restrict__ x,
+template <int32_t vectors, bool from_sums>
+auto instance_normalization_forward_block(float const *__restrict__ x,
                                           float *__restrict__ y,
                                           float const *__restrict__ gamma,
                                           float const *__restrict__ beta,
                                           float *__restrict__ sample_mean,
                                           float *__restrict__ sample_std_dev,
+                                          float const *__restrict__ x_sum,
+                                          float const *__restrict__ x_sum_of_squares,
                                           float epsilon,
-                                          int32_t x_h,
-                                          int32_t x_w) -> void
+                                          int32_t num,
+                                          int32_t channels,
+                                          int32_t lanes) -> void
 {
-  int32_t num = x_h * x_w;
-
-  for (int32_t c = 0; c < x_c; ++c)
-  {
-    sample_mean[c] = 0.0f;
-  }
-  for (int32_t h = 0; h < x_h; ++h)
-  {
-    for (int32_t w = 0; w < x_w; ++w)
+  // Sums are taken relative to the first pixel so that the sum of squares does not cancel catastrophically
+  // when the mean is large compared to the spread. Sums handed over by the producer of x are taken the same way.
+  v128_t offset[vectors];
+  v128_t sum[vectors];
+  v128_t sum_of_squares[vectors];
+  for (int32_t v = 0; v < vectors; ++v)
+  {
+    offset[v] = load_lanes(x + v * 4, lanes - v * 4);
+    if constexpr (from_sums)
     {
-      for (int32_t c = 0; c < x_c; ++c)
-      {
-        int32_t i = h * x_w * x_c + w * x_c + c;
-        sample_mean[c] += x[i];
-      }
+      sum[v] = load_lanes(x_sum + v * 4, lanes - v * 4);
+      sum_of_squares[v] = load_lanes(x_sum_of_squares + v * 4, lanes - v * 4);
+    }
+    else
+    {
+      sum[v] = wasm_f32x4_splat(0.0f);
+      sum_of_squares[v] = wasm_f32x4_splat(0.0f);
     }
-  }
-  for (int32_t c = 0; c < x_c; ++c)
-  {
-    sample_mean[c] /= num;
   }
 
-  for (int32_t c = 0; c < x_c; ++c)
+  if constexpr (!from_sums)
   {
-    sample_std_dev[c] = 0.0f;
-  }
-  for (int32_t h = 0; h < x_h; ++h)
-  {
-    for (int32_t w = 0; w < x_w; ++w)
+    for (int32_t i = 0; i < num; ++i)
     {
-      for (int32_t c = 0; c < x_c; ++c)
+      for (int32_t v = 0; v < vectors; ++v)
       {
-        int32_t i = h * x_w * x_c + w * x_c + c;
-        sample_std_dev[c] += square(x[i] - sample_mean[c]);
+        v128_t d = wasm_f32x4_sub(load_lanes(x + i * channels + v * 4, lanes - v * 4), offset[v]);
+        sum[v] = wasm_f32x4_add(sum[v], d);
+        sum_of_squares[v] = wasm_f32x4_add(sum_of_squares[v], wasm_f32x4_mul(d, d));
       }
     }
   }
-  for (int32_t c = 0; c < x_c; ++c)
+
+  v128_t reciprocal_num = wasm_f32x4_splat(1.0f / num);
+  v128_t scale[vectors];
+  v128_t shift[vectors];
+  for (int32_t v = 0; v < vectors; ++v)
   {
-    sample_std_dev[c] /= num;
+    v128_t mean_offset = wasm_f32x4_mul(sum[v], reciprocal_num);
+    v128_t variance = wasm_f32x4_sub(wasm_f32x4_mul(sum_of_squares[v], reciprocal_num), wasm_f32x4_mul(mean_offset, mean_offset));
+    variance = wasm_f32x4_max(variance, wasm_f32x4_splat(0.0f));
+
+    v128_t mean = wasm_f32x4_add(offset[v], mean_offset);
+    v128_t std_dev = wasm_f32x4_sqrt(wasm_f32x4_add(variance, wasm_f32x4_splat(epsilon)));
+    store_lanes(sample_mean + v * 4, mean, lanes - v * 4);
+    store_lanes(sample_std_dev + v * 4, std_dev, lanes - v * 4);
+
+    // y = (x - mean) / std_dev * gamma + beta, folded into one multiply-add per element.
+    scale[v] = wasm_f32x4_div(load_lanes(gamma + v * 4, lanes - v * 4), std_dev);
+    shift[v] = wasm_f32x4_sub(load_lanes(beta + v * 4, lanes - v * 4), wasm_f32x4_mul(mean, scale[v]));
   }
 
-  for (int32_t c = 0; c < x_c; ++c)
+  for (int32_t i = 0; i < num; ++i)
   {
-    sample_std_dev[c] = __builtin_sqrtf(sample_std_dev[c] + epsilon);
+    for (int32_t v = 0; v < vectors; ++v)
+    {
+      v128_t value = load_lanes(x + i * channels + v * 4, lanes - v * 4);
+      store_lanes(y + i * channels + v * 4, wasm_f32x4_add(wasm_f32x4_mul(value, scale[v]), shift[v]), lanes - v * 4);
+    }
   }
+}
 
-  for (int32_t h = 0; h < x_h; ++h)
+template <int32_t fixed_x_c, bool from_sums>
+auto instance_normalization_forward_inner(float const *__restrict__ x,
+                                          float *__restrict__ y,
+                                          float const *__restrict__ gamma,
+                                          float const *__restrict__ beta,
+                                          float *__restrict__ sample_mean,
+                                          float *__restrict__ sample_std_dev,
+                                          float const *__restrict__ x_sum,
+                                          float const *__restrict__ x_sum_of_squares,
+                                          float epsilon,
+                                          int32_t x_h,
+                                          int32_t x_w,
+                                          int32_t x_c,
+                                          int32_t blocked) -> void
+{
+  x_c = channel_count<fixed_x_c>(x_c);
+
+  int32_t num = x_h * x_w;
+
+  // A channel-blocked x already keeps every 4 channels in one contiguous plane.
+  if (blocked)
   {
-    for (int32_t w = 0; w < x_w; ++w)
+    for (int32_t c = 0; c < x_c; c += 4)
     {
-      for (int32_t c = 0; c < x_c; ++c)
-      {
-        int32_t i = h * x_w * x_c + w * x_c + c;
-        y[i] = x[i];
-        y[i] -= sample_mean[c];
-        y[i] /= sample_std_dev[c];
-        y[i] *= gamma[c];
-        y[i] += beta[c];
-      }
+      instance_normalization_forward_block<1, from_sums>(x + c * num,
+                                                         y + c * num,
+                                                         gamma + c,
+                                                         beta + c,
+                                                         sample_mean + c,
+                                                         sample_std_dev + c,
+                                                         x_sum + c,
+                                                         x_sum_of_squares + c,
+                                                         epsilon,
+                                                         num,
+                                                         4,
+                                                         min(4, x_c - c));
     }
+    return;
+  }
+
+  // Blocks of 16 channels span one cache line per pixel, so each block streams its share of the tensor once
+  // for the statistics and once for the normalization.
+  int32_t c = 0;
+  for (; c + 16 <= x_c; c += 16)
+  {
+    instance_normalization_forward_block<4, from_sums>(x + c,
+                                                       y + c,
+                                                       gamma + c,
+                                                       beta + c,
+                                                       sample_mean + c,
+                                                       sample_std_dev + c,
+                                                       x_sum + c,
+                                                       x_sum_of_squares + c,
+                                                       epsilon,
+                                                       num,
+                                                       x_c,
+                                                       16);
+  }
+  for (; c < x_c; c += 4)
+  {
+    instance_normalization_forward_block<1, from_sums>(x + c,
+                                                       y + c,
+                                                       gamma + c,
+                                                       beta + c,
+                                                       sample_mean + c,
+                                                       sample_std_dev + c,
+                                                       x_sum + c,
+                                                       x_sum_of_squares + c,
+                                                       epsilon,
+                                                       num,
+                                                       x_c,
+                                                       x_c - c);
   }
 }
 
@@ -744,112 +1429,61 @@ auto instance_normalization_forward(float const *__restrict__ x,
                                     float epsilon,
                                     int32_t x_h,
                                     int32_t x_w,
-                                    int32_t x_c) -> void
-{
-  if (x_c == 16)
-  {
-    instance_normalization_forward_inner<16>(x,
-                                             y,
-                                             gamma,
-                                             beta,
-                                             sample_mean,
-                                             sample_std_dev,
-                                             epsilon, x_h, x_w);
-  }
-  else if (x_c == 24)
-  {
-    instance_normalization_forward_inner<24>(x,
-                                             y,
-                                             gamma,
-                                             beta,
-                                             sample_mean,
-                                             sample_std_dev,
-                                             epsilon, x_h, x_w);
-  }
-  else if (x_c == 32)
-  {
-    instance_normalization_forward_inner<32>(x,
-                                             y,
-                                             gamma,
-                                             beta,
-                                             sample_mean,
-                                             sample_std_dev,
-                                             epsilon, x_h, x_w);
-  }
-  else if (x_c == 40)
-  {
-    instance_normalization_forward_inner<40>(x,
-                                             y,
-                                             gamma,
-                                             beta,
-                                             sample_mean,
-                                             sample_std_dev,
-                                             epsilon, x_h, x_w);
-  }
-  else if (x_c == 48)
-  {
-    instance_normalization_forward_inner<48>(x,
-                                             y,
-                                             gamma,
-                                             beta,
-                                             sample_mean,
-                                             sample_std_dev,
-                                             epsilon, x_h, x_w);
-  }
-  else if (x_c == 2 * 16)
-  {
-    instance_normalization_forward_inner<2 * 16>(x,
-                                                 y,
-                                                 gamma,
-                                                 beta,
-                                                 sample_mean,
-                                                 sample_std_dev,
-                                                 epsilon, x_h, x_w);
-  }
-  else if (x_c == 2 * 24)
-  {
-    instance_normalization_forward_inner<2 * 24>(x,
-                                                 y,
-                                                 gamma,
-                                                 beta,
-                                                 sample_mean,
-                                                 sample_std_dev,
-                                                 epsilon, x_h, x_w);
-  }
-  else if (x_c == 2 * 32)
-  {
-    instance_normalization_forward_inner<2 * 32>(x,
-                                                 y,
-                                                 gamma,
-                                                 beta,
-                                                 sample_mean,
-                                                 sample_std_dev,
-                                                 epsilon, x_h, x_w);
-  }
-  else if (x_c == 2 * 40)
-  {
-    instance_normalization_forward_inner<2 * 40>(x,
-                                                 y,
-                                                 gamma,
-                                                 beta,
-                                                 sample_mean,
-                                                 sample_std_dev,
-                                                 epsilon, x_h, x_w);
-  }
-  else if (x_c == 2 * 48)
-  {
-    instance_normalization_forward_inner<2 * 48>(x,
-                                                 y,
-                                                 gamma,
-                                                 beta,
-                                                 sample_mean,
-                                                 sample_std_dev,
-                                                 epsilon, x_h, x_w);
-  }
-}
-
-template <int32_t x_c>
-auto instance_normalization_backward_inner(float const *__restrict__ d_y,
+                                    int32_t x_c,
+                                    int32_t blocked) -> void
+{
+  static constexpr auto table = make_channel_table([]<int32_t fixed_x_c>()
+                                                   { return &instance_normalization_forward_inner<fixed_x_c, false>; });
+  table[x_c](x,
+             y,
+             gamma,
+             beta,
+             sample_mean,
+             sample_std_dev,
+             nullptr,
+             nullptr,
+             epsilon,
+             x_h,
+             x_w,
+             x_c,
+             blocked);
+}
+
+// Same as instance_normalization_forward, but with the per-channel sum and sum of squares of x, relative to its
+// first pixel, already gathered by the layer that produced x, so only the normalization pass reads x.
+auto instance_normalization_forward_from_sums(float const *__restrict__ x,
+                                              float *__restrict__ y,
+                                              float const *__restrict__ gamma,
+                                              float const *__restrict__ beta,
+                                              float *__restrict__ sample_mean,
+                                              float *__restrict__ sample_std_dev,
+                                              float const *__restrict__ x_sum,
+                                              float const *__restrict__ x_sum_of_squares,
+                                              float epsilon,
+                                              int32_t x_h,
+                                              int32_t x_w,
+                                              int32_t x_c,
+                                              int32_t blocked) -> void
+{
+  static constexpr auto table = make_channel_table([]<int32_t fixed_x_c>()
+                                                   { return &instance_normalization_forward_inner<fixed_x_c, true>; });
+  table[x_c](x,
+             y,
+             gamma,
+             beta,
+             sample_mean,
+             sample_std_dev,
+             x_sum,
+             x_sum_of_squares,
+             epsilon,
+             x_h,
+             x_w,
+             x_c,
+             blocked);
+}
+
+template <int32_t vectors>
+auto instance_normalization_backward_block(float const *__restrict__ d_y,
                                            float *__restrict__ d_x,
                                            float *__restrict__ d_gamma,
                                            float *__restrict__ d_beta,
@@ -857,60 +1491,132 @@ auto instance_normalization_backward_inner(float const *__restrict__ d_y,
                                            float const *__restrict__ sample_mean,
                                            float const *__restrict__ sample_std_dev,
                                            float const *__restrict__ x,
-                                           float *__restrict__ sum_1,
-                                           float *__restrict__ sum_2,
-                                           int32_t x_h,
-                                           int32_t x_w) -> void
+                                           int32_t num,
+                                           int32_t channels,
+                                           int32_t lanes,
+                                           int32_t accumulate) -> void
 {
-  int32_t num = x_h * x_w;
+  v128_t mean[vectors];
+  v128_t reciprocal_std_dev[vectors];
+  v128_t sum_d_y[vectors];
+  v128_t sum_d_y_x_hat[vectors];
+  for (int32_t v = 0; v < vectors; ++v)
+  {
+    mean[v] = load_lanes(sample_mean + v * 4, lanes - v * 4);
+    reciprocal_std_dev[v] = wasm_f32x4_div(wasm_f32x4_splat(1.0f), load_lanes(sample_std_dev + v * 4, lanes - v * 4));
+    sum_d_y[v] = wasm_f32x4_splat(0.0f);
+    sum_d_y_x_hat[v] = wasm_f32x4_splat(0.0f);
+  }
 
-  for (int32_t h = 0; h < x_h; ++h)
+  for (int32_t i = 0; i < num; ++i)
   {
-    for (int32_t w = 0; w < x_w; ++w)
+    for (int32_t v = 0; v < vectors; ++v)
     {
-      for (int32_t c = 0; c < x_c; ++c)
-      {
-        int32_t i = h * x_w * x_c + w * x_c + c;
-        d_beta[c] += d_y[i];
-      }
+      v128_t d = load_lanes(d_y + i * channels + v * 4, lanes - v * 4);
+      v128_t x_hat = wasm_f32x4_mul(wasm_f32x4_sub(load_lanes(x + i * channels + v * 4, lanes - v * 4), mean[v]), reciprocal_std_dev[v]);
+      sum_d_y[v] = wasm_f32x4_add(sum_d_y[v], d);
+      sum_d_y_x_hat[v] = wasm_f32x4_add(sum_d_y_x_hat[v], wasm_f32x4_mul(d, x_hat));
     }
   }
 
-  for (int32_t h = 0; h < x_h; ++h)
+  // d_x = gamma / std_dev * (d_y - x_hat * mean(d_y * x_hat) - mean(d_y)), expanded to d_x += a * d_y + b * x + c.
+  v128_t reciprocal_num = wasm_f32x4_splat(1.0f / num);
+  v128_t a[vectors];
+  v128_t b[vectors];
+  v128_t c[vectors];
+  for (int32_t v = 0; v < vectors; ++v)
   {
-    for (int32_t w = 0; w < x_w; ++w)
-    {
-      for (int32_t c = 0; c < x_c; ++c)
-      {
-        int32_t i = h * x_w * x_c + w * x_c + c;
-        d_gamma[c] += d_y[i] * ((x[i] - sample_mean[c]) / sample_std_dev[c]);
-      }
-    }
+    store_lanes(d_beta + v * 4, wasm_f32x4_add(load_lanes(d_beta + v * 4, lanes - v * 4), sum_d_y[v]), lanes - v * 4);
+    store_lanes(d_gamma + v * 4, wasm_f32x4_add(load_lanes(d_gamma + v * 4, lanes - v * 4), sum_d_y_x_hat[v]), lanes - v * 4);
+
+    a[v] = wasm_f32x4_mul(load_lanes(gamma + v * 4, lanes - v * 4), reciprocal_std_dev[v]);
+    b[v] = wasm_f32x4_neg(wasm_f32x4_mul(wasm_f32x4_mul(a[v], reciprocal_std_dev[v]), wasm_f32x4_mul(sum_d_y_x_hat[v], reciprocal_num)));
+    c[v] = wasm_f32x4_neg(wasm_f32x4_add(wasm_f32x4_mul(a[v], wasm_f32x4_mul(sum_d_y[v], reciprocal_num)), wasm_f32x4_mul(b[v], mean[v])));
   }
 
-  for (int32_t h = 0; h < x_h; ++h)
+  for (int32_t i = 0; i < num; ++i)
   {
-    for (int32_t w = 0; w < x_w; ++w)
+    for (int32_t v = 0; v < vectors; ++v)
     {
-      for (int32_t c = 0; c < x_c; ++c)
-      {
-        int32_t i = h * x_w * x_c + w * x_c + c;
-        sum_1[c] += d_y[i] * gamma[c] / num;
-        sum_2[c] += d_y[i] * gamma[c] * ((x[i] - sample_mean[c]) / sample_std_dev[c]) / num;
-      }
+      float *d_x_i = d_x + i * channels + v * 4;
+      v128_t value = accumulate ? load_lanes(d_x_i, lanes - v * 4) : wasm_f32x4_splat(0.0f);
+      value = wasm_f32x4_add(value, wasm_f32x4_mul(a[v], load_lanes(d_y + i * channels + v * 4, lanes - v * 4)));
+      value = wasm_f32x4_add(value, wasm_f32x4_mul(b[v], load_lanes(x + i * channels + v * 4, lanes - v * 4)));
+      store_lanes(d_x_i, wasm_f32x4_add(value, c[v]), lanes - v * 4);
     }
   }
+}
+
+template <int32_t fixed_x_c>
+auto instance_normalization_backward_inner(float const *__restrict__ d_y,
+                                           float *__restrict__ d_x,
+                                           float *__restrict__ d_gamma,
+                                           float *__restrict__ d_beta,
+                                           float const *__restrict__ gamma,
+                                           float const *__restrict__ sample_mean,
+                                           float const *__restrict__ sample_std_dev,
+                                           float const *__restrict__ x,
+                                           int32_t x_h,
+                                           int32_t x_w,
+                                           int32_t x_c,
+                                           int32_t blocked,
+                                           int32_t accumulate) -> void
+{
+  x_c = channel_count<fixed_x_c>(x_c);
+
+  int32_t num = x_h * x_w;
 
-  for (int32_t h = 0; h < x_h; ++h)
+  if (blocked)
   {
-    for (int32_t w = 0; w < x_w; ++w)
+    for (int32_t c = 0; c < x_c; c += 4)
     {
-      for (int32_t c = 0; c < x_c; ++c)
-      {
-        int32_t i = h * x_w * x_c + w * x_c + c;
-        d_x[i] += (d_y[i] * gamma[c] - ((x[i] - sample_mean[c]) / sample_std_dev[c]) * sum_2[c] - sum_1[c]) / sample_std_dev[c];
-      }
+      instance_normalization_backward_block<1>(d_y + c * num,
+                                               d_x + c * num,
+                                               d_gamma + c,
+                                               d_beta + c,
+                                               gamma + c,
+                                               sample_mean + c,
+                                               sample_std_dev + c,
+                                               x + c * num,
+                                               num,
+                                               4,
+                                               min(4, x_c - c),
+                                               accumulate);
     }
+    return;
+  }
+
+  // One pass gathers every per-channel reduction, a second writes d_x.
+  int32_t c = 0;
+  for (; c + 16 <= x_c; c += 16)
+  {
+    instance_normalization_backward_block<4>(d_y + c,
+                                             d_x + c,
+                                             d_gamma + c,
+                                             d_beta + c,
+                                             gamma + c,
+                                             sample_mean + c,
+                                             sample_std_dev + c,
+                                             x + c,
+                                             num,
+                                             x_c,
+                                             16,
+                                             accumulate);
+  }
+  for (; c < x_c; c += 4)
+  {
+    instance_normalization_backward_block<1>(d_y + c,
+                                             d_x + c,
+                                             d_gamma + c,
+                                             d_beta + c,
+                                             gamma + c,
+                                             sample_mean + c,
+                                             sample_std_dev + c,
+                                             x + c,
+                                             num,
+                                             x_c,
+                                             x_c - c,
+                                             accumulate);
   }
 }
 
@@ -922,1269 +1628,3045 @@ auto instance_normalization_backward(float const *__restrict__ d_y,
                                      float const *__restrict__ sample_mean,
                                      float const *__restrict__ sample_std_dev,
                                      float const *__restrict__ x,
-                                     float *__restrict__ sum_1,
-                                     float *__restrict__ sum_2,
                                      int32_t x_h,
                                      int32_t x_w,
-                                     int32_t x_c) -> void
-{
-  if (x_c == 16)
-  {
-    instance_normalization_backward_inner<16>(d_y,
-                                              d_x,
-                                              d_gamma,
-                                              d_beta,
-                                              gamma,
-                                              sample_mean,
-                                              sample_std_dev,
-                                              x, sum_1,
-                                              sum_2,
-                                              x_h,
-                                              x_w);
-  }
-  else if (x_c == 24)
-  {
-    instance_normalization_backward_inner<24>(d_y,
-                                              d_x,
-                                              d_gamma,
-                                              d_beta,
-                                              gamma,
-                                              sample_mean,
-                                              sample_std_dev,
-                                              x, sum_1,
-                                              sum_2,
-                                              x_h,
-                                              x_w);
-  }
-  else if (x_c == 32)
-  {
-    instance_normalization_backward_inner<32>(d_y,
-                                              d_x,
-                                              d_gamma,
-                                              d_beta,
-                                              gamma,
-                                              sample_mean,
-                                              sample_std_dev,
-                                              x, sum_1,
-                                              sum_2,
-                                              x_h,
-                                              x_w);
-  }
-  else if (x_c == 40)
-  {
-    instance_normalization_backward_inner<40>(d_y,
-                                              d_x,
-                                              d_gamma,
-                                              d_beta,
-                                              gamma,
-                                              sample_mean,
-                                              sample_std_dev,
-                                              x, sum_1,
-                                              sum_2,
-                                              x_h,
-                                              x_w);
-  }
-  else if (x_c == 48)
-  {
-    instance_normalization_backward_inner<48>(d_y,
-                                              d_x,
-                                              d_gamma,
-                                              d_beta,
-                                              gamma,
-                                              sample_mean,
-                                              sample_std_dev,
-                                              x, sum_1,
-                                              sum_2,
-                                              x_h,
-                                              x_w);
-  }
-  else if (x_c == 2 * 16)
-  {
-    instance_normalization_backward_inner<2 * 16>(d_y,
-                                                  d_x,
-                                                  d_gamma,
-                                                  d_beta,
-                                                  gamma,
-                                                  sample_mean,
-                                                  sample_std_dev,
-                                                  x, sum_1,
-                                                  sum_2,
-                                                  x_h,
-                                                  x_w);
-  }
-  else if (x_c == 2 * 24)
-  {
-    instance_normalization_backward_inner<2 * 24>(d_y,
-                                                  d_x,
-                                                  d_gamma,
-                                                  d_beta,
-                                                  gamma,
-                                                  sample_mean,
-                                                  sample_std_dev,
-                                                  x, sum_1,
-                                                  sum_2,
-                                                  x_h,
-                                                  x_w);
-  }
-  else if (x_c == 2 * 32)
-  {
-    instance_normalization_backward_inner<2 * 32>(d_y,
-                                                  d_x,
-                                                  d_gamma,
-                                                  d_beta,
-                                                  gamma,
-                                                  sample_mean,
-                                                  sample_std_dev,
-                                                  x, sum_1,
-                                                  sum_2,
-                                                  x_h,
-                                                  x_w);
-  }
-  else if (x_c == 2 * 40)
-  {
-    instance_normalization_backward_inner<2 * 40>(d_y,
-                                                  d_x,
-                                                  d_gamma,
-                                                  d_beta,
-                                                  gamma,
-                                                  sample_mean,
-                                                  sample_std_dev,
-                                                  x, sum_1,
-                                                  sum_2,
-                                                  x_h,
-                                                  x_w);
-  }
-  else if (x_c == 2 * 48)
-  {
-    instance_normalization_backward_inner<2 * 48>(d_y,
-                                                  d_x,
-                                                  d_gamma,
-                                                  d_beta,
-                                                  gamma,
-                                                  sample_mean,
-                                                  sample_std_dev,
-                                                  x, sum_1,
-                                                  sum_2,
-                                                  x_h,
-                                                  x_w);
-  }
-}
-
-template <int32_t channels_out>
-auto pointwise_convolution_forward_inner(float const *__restrict__ in,
-                                         float *__restrict__ out,
-                                         float const *__restrict__ kernel,
-                                         float const *__restrict__ bias,
-                                         int32_t height,
-                                         int32_t width,
-                                         int32_t channels_in) -> void
+                                     int32_t x_c,
+                                     int32_t blocked,
+                                     int32_t accumulate) -> void
+{
+  static constexpr auto table = make_channel_table([]<int32_t fixed_x_c>()
+                                                   { return &instance_normalization_backward_inner<fixed_x_c>; });
+  table[x_c](d_y,
+             d_x,
+             d_gamma,
+             d_beta,
+             gamma,
+             sample_mean,
+             sample_std_dev,
+             x,
+             x_h,
+             x_w,
+             x_c,
+             blocked,
+             accumulate);
+}
+
+auto pack_pointwise_convolution_kernel(float const *__restrict__ kernel,
+                                       float *__restrict__ packed_kernel,
+                                       float *__restrict__ packed_kernel_transposed,
+                                       int32_t channels_in,
+                                       int32_t channels_out) -> void
 {
-  for (int32_t i_m = 0; i_m < height * width; ++i_m)
+  // Both layouts are split into panels of 8 columns, zero-padded, so a tile reads one contiguous panel.
+  for (int32_t i_n = 0; i_n < channels_out; i_n += 8)
   {
-    for (int32_t i_n = 0; i_n < channels_out; ++i_n)
+    for (int32_t i_k = 0; i_k < channels_in; ++i_k)
     {
-      out[i_m * channels_out + i_n] = bias[i_n];
+      for (int32_t j = 0; j < 8; ++j)
+      {
+        float value = i_n + j < channels_out ? kernel[i_k * channels_out + i_n + j] : 0.0f;
+        packed_kernel[i_n * channels_in + i_k * 8 + j] = value;
+      }
     }
+  }
 
-    for (int32_t i_k = 0; i_k < channels_in; i_k += 4)
+  for (int32_t i_n = 0; i_n < channels_in; i_n += 8)
+  {
+    for (int32_t i_k = 0; i_k < channels_out; ++i_k)
     {
-      float a_0 = in[i_m * channels_in + (i_k + 0)];
-      float a_1 = in[i_m * channels_in + (i_k + 1)];
-      float a_2 = in[i_m * channels_in + (i_k + 2)];
-      float a_3 = in[i_m * channels_in + (i_k + 3)];
-      for (int32_t i_n = 0; i_n < channels_out; ++i_n)
+      for (int32_t j = 0; j < 8; ++j)
       {
-        out[i_m * channels_out + i_n] += a_0 * kernel[(i_k + 0) * channels_out + i_n];
-        out[i_m * channels_out + i_n] += a_1 * kernel[(i_k + 1) * channels_out + i_n];
-        out[i_m * channels_out + i_n] += a_2 * kernel[(i_k + 2) * channels_out + i_n];
-        out[i_m * channels_out + i_n] += a_3 * kernel[(i_k + 3) * channels_out + i_n];
+        float value = i_n + j < channels_in ? kernel[(i_n + j) * channels_out + i_k] : 0.0f;
+        packed_kernel_transposed[i_n * channels_out + i_k * 8 + j] = value;
       }
     }
   }
 }
 
-auto pointwise_convolution_forward(float const *__restrict__ in,
-                                   float *__restrict__ out,
-                                   float const *__restrict__ kernel,
-                                   float const *__restrict__ bias,
-                                   int32_t height,
-                                   int32_t width,
-                                   int32_t channels_in,
-                                   int32_t channels_out) -> void
-{
-  if (channels_out == 16)
-  {
-    pointwise_convolution_forward_inner<16>(in,
-                                            out,
-                                            kernel,
-                                            bias,
-                                            height,
-                                            width,
-                                            channels_in);
-  }
-  else if (channels_out == 24)
-  {
-    pointwise_convolution_forward_inner<24>(in,
-                                            out,
-                                            kernel,
-                                            bias,
-                                            height,
-                                            width,
-                                            channels_in);
-  }
-  else if (channels_out == 32)
-  {
-    pointwise_convolution_forward_inner<32>(in,
-                                            out,
-                                            kernel,
-                                            bias,
-                                            height,
-                                            width,
-                                            channels_in);
-  }
-  else if (channels_out == 40)
-  {
-    pointwise_convolution_forward_inner<40>(in,
-                                            out,
-                                            kernel,
-                                            bias,
-                                            height,
-                                            width,
-                                            channels_in);
-  }
-  else if (channels_out == 48)
-  {
-    pointwise_convolution_forward_inner<48>(in,
-                                            out,
-                                            kernel,
-                                            bias,
-                                            height,
-                                            width,
-                                            channels_in);
-  }
-  else if (channels_out == 2 * 16)
-  {
-    pointwise_convolution_forward_inner<2 * 16>(in,
-                                                out,
-                                                kernel,
-                                                bias,
-                                                height,
-                                                width,
-                                                channels_in);
-  }
-  else if (channels_out == 2 * 24)
-  {
-    pointwise_convolution_forward_inner<2 * 24>(in,
-                                                out,
-                                                kernel,
-                                                bias,
-                                                height,
-                                                width,
-                                                channels_in);
-  }
-  else if (channels_out == 2 * 32)
-  {
-    pointwise_convolution_forward_inner<2 * 32>(in,
-                                                out,
-                                                kernel,
-                                                bias,
-                                                height,
-                                                width,
-                                                channels_in);
-  }
-  else if (channels_out == 2 * 40)
-  {
-    pointwise_convolution_forward_inner<2 * 40>(in,
-                                                out,
-                                                kernel,
-                                                bias,
-                                                height,
-                                                width,
-                                                channels_in);
-  }
-  else if (channels_out == 2 * 48)
-  {
-    pointwise_convolution_forward_inner<2 * 48>(in,
-                                                out,
-                                                kernel,
-                                                bias,
-                                                height,
-                                                width,
-                                                channels_in);
-  }
-  else if (channels_out == 4 * 4 * 1)
-  {
-    pointwise_convolution_forward_inner<4 * 4 * 1>(in,
-                                                   out,
-                                                   kernel,
-                                                   bias,
-                                                   height,
-                                                   width,
-                                                   channels_in);
-  }
-  else if (channels_out == 4 * 4 * 2)
-  {
-    pointwise_convolution_forward_inner<4 * 4 * 2>(in,
-                                                   out,
-                                                   kernel,
-                                                   bias,
-                                                   height,
-                                                   width,
-                                                   channels_in);
-  }
-  else if (channels_out == 4 * 4 * 3)
-  {
-    pointwise_convolution_forward_inner<4 * 4 * 3>(in,
-                                                   out,
-                                                   kernel,
-                                                   bias,
-                                                   height,
-                                                   width,
-                                                   channels_in);
-  }
-  else if (channels_out == 4 * 4 * 4)
-  {
-    pointwise_convolution_forward_inner<4 * 4 * 4>(in,
-                                                   out,
-                                                   kernel,
-                                                   bias,
-                                                   height,
-                                                   width,
-                                                   channels_in);
-  }
-  else if (channels_out == 4 * 4 * 5)
-  {
-    pointwise_convolution_forward_inner<4 * 4 * 5>(in,
-                                                   out,
-                                                   kernel,
-                                                   bias,
-                                                   height,
-                                                   width,
-                                                   channels_in);
-  }
-  else if (channels_out == 4 * 4 * 6)
+auto pack_pointwise_convolution_kernel_scaled(float const *__restrict__ kernel,
+                                              float *__restrict__ packed_kernel,
+                                              int32_t channels_in,
+                                              int32_t channels_out,
+                                              float scale) -> void
+{
+  // The forward layout of pack_pointwise_convolution_kernel with every weight multiplied by scale, used to
+  // fold a constant input scaling into the kernel.
+  for (int32_t i_n = 0; i_n < channels_out; i_n += 8)
   {
-    pointwise_convolution_forward_inner<4 * 4 * 6>(in,
-                                                   out,
-                                                   kernel,
-                                                   bias,
-                                                   height,
-                                                   width,
-                                                   channels_in);
+    for (int32_t i_k = 0; i_k < channels_in; ++i_k)
+    {
+      for (int32_t j = 0; j < 8; ++j)
+      {
+        float value = i_n + j < channels_out ? kernel[i_k * channels_out + i_n + j] * scale : 0.0f;
+        packed_kernel[i_n * channels_in + i_k * 8 + j] = value;
+      }
+    }
   }
-  else if (channels_out == 4 * 4 * 7)
+}
+
+// Quantizes count values of x to int8 by multiplying with reciprocal_scale, rounding to nearest and saturating to
+// [-127, 127] so the range stays symmetric, and zero-fills q up to padded_count.
+auto quantize_activations(float const *__restrict__ x,
+                          int8_t *__restrict__ q,
+                          int32_t count,
+                          int32_t padded_count,
+                          float reciprocal_scale) -> void
+{
+  v128_t multiplier = wasm_f32x4_splat(reciprocal_scale);
+  v128_t low = wasm_f32x4_splat(-127.0f);
+  v128_t high = wasm_f32x4_splat(127.0f);
+  auto quantize = [&](float const *x_i) -> v128_t
   {
-    pointwise_convolution_forward_inner<4 * 4 * 7>(in,
-                                                   out,
-                                                   kernel,
-                                                   bias,
-                                                   height,
-                                                   width,
-                                                   channels_in);
-  }
-  else if (channels_out == 4 * 4 * 8)
+    v128_t value = wasm_f32x4_min(wasm_f32x4_max(wasm_f32x4_mul(wasm_v128_load(x_i), multiplier), low), high);
+    return wasm_i32x4_trunc_sat_f32x4(wasm_f32x4_nearest(value));
+  };
+
+  int32_t i = 0;
+  for (; i + 16 <= count; i += 16)
   {
-    pointwise_convolution_forward_inner<4 * 4 * 8>(in,
-                                                   out,
-                                                   kernel,
-                                                   bias,
-                                                   height,
-                                                   width,
-                                                   channels_in);
+    v128_t q_0 = wasm_i16x8_narrow_i32x4(quantize(x + i + 0), quantize(x + i + 4));
+    v128_t q_1 = wasm_i16x8_narrow_i32x4(quantize(x + i + 8), quantize(x + i + 12));
+    wasm_v128_store(q + i, wasm_i8x16_narrow_i16x8(q_0, q_1));
   }
-  else if (channels_out == 4 * 4 * 9)
+  for (; i < count; ++i)
   {
-    pointwise_convolution_forward_inner<4 * 4 * 9>(in,
-                                                   out,
-                                                   kernel,
-                                                   bias,
-                                                   height,
-                                                   width,
-                                                   channels_in);
+    q[i] = static_cast<int8_t>(__builtin_rintf(min(max(x[i] * reciprocal_scale, -127.0f), 127.0f)));
   }
-  else if (channels_out == 4 * 4 * 10)
+  for (; i < padded_count; ++i)
   {
-    pointwise_convolution_forward_inner<4 * 4 * 10>(in,
-                                                    out,
-                                                    kernel,
-                                                    bias,
-                                                    height,
-                                                    width,
-                                                    channels_in);
+    q[i] = 0;
   }
 }
 
-template <int32_t channels_out>
-auto pointwise_convolution_backward_inner(float const *__restrict__ d_out,
-                                          float *__restrict__ d_in,
-                                          float *__restrict__ d_kernel,
-                                          float *__restrict__ d_bias,
-                                          float const *__restrict__ in,
-                                          float const *__restrict__ kernel,
-                                          float *__restrict__ kernel_buffer,
-                                          int32_t height,
-                                          int32_t width,
-                                          int32_t channels_in) -> void
+auto quantize_pointwise_convolution_kernel(float const *__restrict__ kernel,
+                                           int8_t *__restrict__ packed_kernel,
+                                           float *__restrict__ kernel_scales,
+                                           int32_t channels_in,
+                                           int32_t channels_out) -> void
 {
-  for (int32_t i_k = 0; i_k < channels_out; ++i_k)
+  // Every output channel gets its own symmetric scale, the largest magnitude of its weights over 127.
+  for (int32_t n = 0; n < channels_out; ++n)
   {
-    for (int32_t i_n = 0; i_n < channels_in; ++i_n)
+    float magnitude = 0.0f;
+    for (int32_t k = 0; k < channels_in; ++k)
     {
-      kernel_buffer[i_k * channels_in + i_n] = kernel[i_n * channels_out + i_k];
+      magnitude = max(magnitude, __builtin_fabsf(kernel[k * channels_out + n]));
     }
+    kernel_scales[n] = magnitude / 127.0f;
   }
 
-  for (int32_t i_m = 0; i_m < height * width; ++i_m)
+  // The forward layout of pack_pointwise_convolution_kernel with the input channels taken in pairs: each pair is
+  // 16 bytes, the two weights of every column next to each other, so that i32x4.dot_i16x8_s multiplies two input
+  // channels into 4 columns at once. An odd channels_in is padded with a zero row.
+  int32_t channel_pairs = (channels_in + 1) / 2;
+  for (int32_t i_n = 0; i_n < channels_out; i_n += 8)
   {
-    for (int32_t i_k = 0; i_k < channels_out; i_k += 4)
+    for (int32_t p = 0; p < channel_pairs; ++p)
     {
-      float a_0 = d_out[i_m * channels_out + (i_k + 0)];
-      float a_1 = d_out[i_m * channels_out + (i_k + 1)];
-      float a_2 = d_out[i_m * channels_out + (i_k + 2)];
-      float a_3 = d_out[i_m * channels_out + (i_k + 3)];
-      for (int32_t i_n = 0; i_n < channels_in; ++i_n)
+      for (int32_t j = 0; j < 8; ++j)
       {
-        d_in[i_m * channels_in + i_n] += a_0 * kernel_buffer[(i_k + 0) * channels_in + i_n];
-        d_in[i_m * channels_in + i_n] += a_1 * kernel_buffer[(i_k + 1) * channels_in + i_n];
-        d_in[i_m * channels_in + i_n] += a_2 * kernel_buffer[(i_k + 2) * channels_in + i_n];
-        d_in[i_m * channels_in + i_n] += a_3 * kernel_buffer[(i_k + 3) * channels_in + i_n];
+        for (int32_t i = 0; i < 2; ++i)
+        {
+          int32_t k = p * 2 + i;
+          int32_t n = i_n + j;
+          float value = k < channels_in && n < channels_out && kernel_scales[n] > 0.0f ? kernel[k * channels_out + n] / kernel_scales[n] : 0.0f;
+          packed_kernel[i_n * channel_pairs * 2 + p * 16 + j * 2 + i] = static_cast<int8_t>(__builtin_rintf(value));
+        }
       }
     }
   }
+}
+
+template <int32_t tile_m, bool hard_swish_epilogue, typename T>
+auto pointwise_convolution_forward_tile(float const *__restrict__ in,
+                                        T *__restrict__ out,
+                                        type_identity_t<T> *__restrict__ pre_activation,
+                                        float const *__restrict__ packed_kernel,
+                                        float const *__restrict__ bias,
+                                        int32_t channels_in,
+                                        tensor_layout in_layout,
+                                        tensor_layout out_layout,
+                                        int32_t columns) -> void
+{
+  // A tile_m x 8 block of outputs stays in registers for the whole reduction over channels_in.
+  v128_t acc_0[tile_m];
+  v128_t acc_1[tile_m];
+
+  v128_t bias_0 = load_lanes(bias + 0, columns);
+  v128_t bias_1 = load_lanes(bias + 4, columns - 4);
+  for (int32_t m = 0; m < tile_m; ++m)
+  {
+    acc_0[m] = bias_0;
+    acc_1[m] = bias_1;
+  }
 
-  for (int32_t i_k = 0; i_k < height * width; i_k += 4)
+  for (int32_t i_k = 0; i_k < channels_in; ++i_k)
   {
-    for (int32_t i_m = 0; i_m < channels_in; ++i_m)
+    v128_t k_0 = wasm_v128_load(packed_kernel + i_k * 8 + 0);
+    v128_t k_1 = wasm_v128_load(packed_kernel + i_k * 8 + 4);
+    float const *in_k = in + in_layout.offset(0, i_k);
+    for (int32_t m = 0; m < tile_m; ++m)
     {
-      float a_0 = in[(i_k + 0) * channels_in + i_m];
-      float a_1 = in[(i_k + 1) * channels_in + i_m];
-      float a_2 = in[(i_k + 2) * channels_in + i_m];
-      float a_3 = in[(i_k + 3) * channels_in + i_m];
-      for (int32_t i_n = 0; i_n < channels_out; ++i_n)
-      {
-        d_kernel[i_m * channels_out + i_n] += a_0 * d_out[(i_k + 0) * channels_out + i_n];
-        d_kernel[i_m * channels_out + i_n] += a_1 * d_out[(i_k + 1) * channels_out + i_n];
-        d_kernel[i_m * channels_out + i_n] += a_2 * d_out[(i_k + 2) * channels_out + i_n];
-        d_kernel[i_m * channels_out + i_n] += a_3 * d_out[(i_k + 3) * channels_out + i_n];
-      }
+      v128_t a = wasm_v128_load32_splat(in_k + m * in_layout.pixel_stride);
+      acc_0[m] = wasm_f32x4_add(acc_0[m], wasm_f32x4_mul(a, k_0));
+      acc_1[m] = wasm_f32x4_add(acc_1[m], wasm_f32x4_mul(a, k_1));
     }
   }
 
-  for (int32_t h = 0; h < height; ++h)
+  for (int32_t m = 0; m < tile_m; ++m)
   {
-    for (int32_t w = 0; w < width; ++w)
+    if constexpr (hard_swish_epilogue)
     {
-      for (int32_t c = 0; c < channels_out; ++c)
+      // The pre-activation is only kept when a backward pass will need it.
+      if (pre_activation != nullptr)
       {
-        d_bias[c] += d_out[h * width * channels_out + w * channels_out + c];
+        store_lanes(pre_activation + out_layout.offset(m, 0), acc_0[m], columns);
+        store_lanes(pre_activation + out_layout.offset(m, 4), acc_1[m], columns - 4);
       }
+      acc_0[m] = hard_swish(acc_0[m]);
+      acc_1[m] = hard_swish(acc_1[m]);
     }
+    store_lanes(out + out_layout.offset(m, 0), acc_0[m], columns);
+    store_lanes(out + out_layout.offset(m, 4), acc_1[m], columns - 4);
   }
 }
 
-auto pointwise_convolution_backward(float const *__restrict__ d_out,
-                                    float *__restrict__ d_in,
-                                    float *__restrict__ d_kernel,
-                                    float *__restrict__ d_bias,
-                                    float const *__restrict__ in,
-                                    float const *__restrict__ kernel,
-                                    float *__restrict__ kernel_buffer,
-                                    int32_t height,
-                                    int32_t width,
-                                    int32_t channels_in,
-                                    int32_t channels_out) -> void
-{
-  if (channels_out == 16)
-  {
-    pointwise_convolution_backward_inner<16>(d_out,
-                                             d_in,
-                                             d_kernel,
-                                             d_bias,
-                                             in,
-                                             kernel,
-                                             kernel_buffer,
-                                             height,
-                                             width,
-                                             channels_in);
-  }
-  else if (channels_out == 24)
-  {
-    pointwise_convolution_backward_inner<24>(d_out,
-                                             d_in,
-                                             d_kernel,
-                                             d_bias,
-                                             in,
-                                             kernel,
-                                             kernel_buffer,
-                                             height,
-                                             width,
-                                             channels_in);
-  }
-  else if (channels_out == 32)
-  {
-    pointwise_convolution_backward_inner<32>(d_out,
-                                             d_in,
-                                             d_kernel,
-                                             d_bias,
-                                             in,
-                                             kernel,
-                                             kernel_buffer,
-                                             height,
-                                             width,
-                                             channels_in);
-  }
-  else if (channels_out == 40)
-  {
-    pointwise_convolution_backward_inner<40>(d_out,
-                                             d_in,
-                                             d_kernel,
-                                             d_bias,
-                                             in,
-                                             kernel,
-                                             kernel_buffer,
-                                             height,
-                                             width,
-                                             channels_in);
-  }
-  else if (channels_out == 48)
-  {
-    pointwise_convolution_backward_inner<48>(d_out,
-                                             d_in,
-                                             d_kernel,
-                                             d_bias,
-                                             in,
-                                             kernel,
-                                             kernel_buffer,
-                                             height,
-                                             width,
-                                             channels_in);
-  }
-  else if (channels_out == 2 * 16)
-  {
-    pointwise_convolution_backward_inner<2 * 16>(d_out,
-                                                 d_in,
-                                                 d_kernel,
-                                                 d_bias,
-                                                 in,
-                                                 kernel,
-                                                 kernel_buffer,
-                                                 height,
-                                                 width,
-                                                 channels_in);
-  }
-  else if (channels_out == 2 * 24)
-  {
-    pointwise_convolution_backward_inner<2 * 24>(d_out,
-                                                 d_in,
-                                                 d_kernel,
-                                                 d_bias,
-                                                 in,
-                                                 kernel,
-                                                 kernel_buffer,
-                                                 height,
-                                                 width,
-                                                 channels_in);
-  }
-  else if (channels_out == 2 * 32)
-  {
-    pointwise_convolution_backward_inner<2 * 32>(d_out,
-                                                 d_in,
-                                                 d_kernel,
-                                                 d_bias,
-                                                 in,
-                                                 kernel,
-                                                 kernel_buffer,
-                                                 height,
-                                                 width,
-                                                 channels_in);
-  }
-  else if (channels_out == 2 * 40)
-  {
-    pointwise_convolution_backward_inner<2 * 40>(d_out,
-                                                 d_in,
-                                                 d_kernel,
-                                                 d_bias,
-                                                 in,
-                                                 kernel,
-                                                 kernel_buffer,
-                                                 height,
-                                                 width,
-                                                 channels_in);
-  }
-  else if (channels_out == 2 * 48)
-  {
-    pointwise_convolution_backward_inner<2 * 48>(d_out,
-                                                 d_in,
-                                                 d_kernel,
-                                                 d_bias,
-                                                 in,
-                                                 kernel,
-                                                 kernel_buffer,
-                                                 height,
-                                                 width,
-                                                 channels_in);
-  }
-  else if (channels_out == 4 * 4 * 1)
-  {
-    pointwise_convolution_backward_inner<4 * 4 * 1>(d_out,
-                                                    d_in,
-                                                    d_kernel,
-                                                    d_bias,
-                                                    in,
-                                                    kernel,
-                                                    kernel_buffer,
-                                                    height,
-                                                    width,
-                                                    channels_in);
-  }
-  else if (channels_out == 4 * 4 * 2)
-  {
-    pointwise_convolution_backward_inner<4 * 4 * 2>(d_out,
-                                                    d_in,
-                                                    d_kernel,
-                                                    d_bias,
-                                                    in,
-                                                    kernel,
-                                                    kernel_buffer,
-                                                    height,
-                                                    width,
-                                                    channels_in);
-  }
-  else if (channels_out == 4 * 4 * 3)
-  {
-    pointwise_convolution_backward_inner<4 * 4 * 3>(d_out,
-                                                    d_in,
-                                                    d_kernel,
-                                                    d_bias,
-                                                    in,
-                                                    kernel,
-                                                    kernel_buffer,
-                                                    height,
-                                                    width,
-                                                    channels_in);
-  }
-  else if (channels_out == 4 * 4 * 4)
-  {
-    pointwise_convolution_backward_inner<4 * 4 * 4>(d_out,
-                                                    d_in,
-                                                    d_kernel,
-                                                    d_bias,
-                                                    in,
-                                                    kernel,
-                                                    kernel_buffer,
-                                                    height,
-                                                    width,
-                                                    channels_in);
-  }
-  else if (channels_out == 4 * 4 * 5)
-  {
-    pointwise_convolution_backward_inner<4 * 4 * 5>(d_out,
-                                                    d_in,
-                                                    d_kernel,
-                                                    d_bias,
-                                                    in,
-                                                    kernel,
-                                                    kernel_buffer,
-                                                    height,
-                                                    width,
-                                                    channels_in);
-  }
-  else if (channels_out == 4 * 4 * 6)
-  {
-    pointwise_convolution_backward_inner<4 * 4 * 6>(d_out,
-                                                    d_in,
-                                                    d_kernel,
-                                                    d_bias,
-                                                    in,
-                                                    kernel,
-                                                    kernel_buffer,
-                                                    height,
-                                                    width,
-                                                    channels_in);
-  }
-  else if (channels_out == 4 * 4 * 7)
-  {
-    pointwise_convolution_backward_inner<4 * 4 * 7>(d_out,
-                                                    d_in,
-                                                    d_kernel,
-                                                    d_bias,
-                                                    in,
-                                                    kernel,
-                                                    kernel_buffer,
-                                                    height,
-                                                    width,
-                                                    channels_in);
-  }
-  else if (channels_out == 4 * 4 * 8)
-  {
-    pointwise_convolution_backward_inner<4 * 4 * 8>(d_out,
-                                                    d_in,
-                                                    d_kernel,
-                                                    d_bias,
-                                                    in,
-                                                    kernel,
-                                                    kernel_buffer,
-                                                    height,
-                                                    width,
-                                                    channels_in);
-  }
-  else if (channels_out == 4 * 4 * 9)
-  {
-    pointwise_convolution_backward_inner<4 * 4 * 9>(d_out,
-                                                    d_in,
-                                                    d_kernel,
-                                                    d_bias,
-                                                    in,
-                                                    kernel,
-                                                    kernel_buffer,
-                                                    height,
-                                                    width,
-                                                    channels_in);
-  }
-  else if (channels_out == 4 * 4 * 10)
-  {
-    pointwise_convolution_backward_inner<4 * 4 * 10>(d_out,
-                                                     d_in,
-                                                     d_kernel,
-                                                     d_bias,
-                                                     in,
-                                                     kernel,
-                                                     kernel_buffer,
-                                                     height,
-                                                     width,
-                                                     channels_in);
-  }
-}
-
-template <int32_t channels>
-auto depthwise_convolution_forward_inner(float const *__restrict__ x,
-                                         float *__restrict__ y,
-                                         float const *__restrict__ k,
-                                         [[maybe_unused]] float const *__restrict__ b,
+template <int32_t tile_m, bool hard_swish_epilogue, typename T>
+auto pointwise_convolution_forward_rows(float const *__restrict__ in,
+                                        T *__restrict__ out,
+                                        type_identity_t<T> *__restrict__ pre_activation,
+                                        float const *__restrict__ packed_kernel,
+                                        float const *__restrict__ bias,
+                                        int32_t channels_in,
+                                        int32_t channels_out,
+                                        tensor_layout in_layout,
+                                        tensor_layout out_layout) -> void
+{
+  int32_t i_n = 0;
+  for (; i_n + 8 <= channels_out; i_n += 8)
+  {
+    pointwise_convolution_forward_tile<tile_m, hard_swish_epilogue>(in,
+                                                                    out + out_layout.offset(0, i_n),
+                                                                    pre_activation != nullptr ? pre_activation + out_layout.offset(0, i_n) : nullptr,
+                                                                    packed_kernel + i_n * channels_in,
+                                                                    bias + i_n,
+                                                                    channels_in,
+                                                                    in_layout,
+                                                                    out_layout,
+                                                                    8);
+  }
+  if (i_n < channels_out)
+  {
+    pointwise_convolution_forward_tile<tile_m, hard_swish_epilogue>(in,
+                                                                    out + out_layout.offset(0, i_n),
+                                                                    pre_activation != nullptr ? pre_activation + out_layout.offset(0, i_n) : nullptr,
+                                                                    packed_kernel + i_n * channels_in,
+                                                                    bias + i_n,
+                                                                    channels_in,
+                                                                    in_layout,
+                                                                    out_layout,
+                                                                    channels_out - i_n);
+  }
+}
+
+template <int32_t fixed_channels_out, bool hard_swish_epilogue, typename T = float>
+auto pointwise_convolution_forward_inner(float const *__restrict__ in,
+                                         T *__restrict__ out,
+                                         type_identity_t<T> *__restrict__ pre_activation,
+                                         float const *__restrict__ packed_kernel,
+                                         float const *__restrict__ bias,
                                          int32_t height,
-                                         int32_t width) -> void
+                                         int32_t width,
+                                         int32_t channels_in,
+                                         int32_t channels_out,
+                                         int32_t blocked_in,
+                                         int32_t blocked_out) -> void
 {
-  int32_t constexpr kernel_height = 5;
-  int32_t constexpr kernel_width = 5;
+  channels_out = channel_count<fixed_channels_out>(channels_out);
+
+  int32_t constexpr tile_m = 4;
+
+  // Either side may be channel-blocked, so the layout conversion happens in the loads and stores of the tiles.
+  tensor_layout in_layout = make_tensor_layout(blocked_in, height * width, channels_in);
+  tensor_layout out_layout = make_tensor_layout(blocked_out, height * width, channels_out);
+
+  int32_t i_m = 0;
+  for (; i_m + tile_m <= height * width; i_m += tile_m)
+  {
+    pointwise_convolution_forward_rows<tile_m, hard_swish_epilogue>(in + in_layout.offset(i_m, 0),
+                                                                    out + out_layout.offset(i_m, 0),
+                                                                    pre_activation != nullptr ? pre_activation + out_layout.offset(i_m, 0) : nullptr,
+                                                                    packed_kernel,
+                                                                    bias,
+                                                                    channels_in,
+                                                                    channels_out,
+                                                                    in_layout,
+                                                                    out_layout);
+  }
+  for (; i_m < height * width; ++i_m)
+  {
+    pointwise_convolution_forward_rows<1, hard_swish_epilogue>(in + in_layout.offset(i_m, 0),
+                                                               out + out_layout.offset(i_m, 0),
+                                                               pre_activation != nullptr ? pre_activation + out_layout.offset(i_m, 0) : nullptr,
+                                                               packed_kernel,
+                                                               bias,
+                                                               channels_in,
+                                                               channels_out,
+                                                               in_layout,
+                                                               out_layout);
+  }
+}
 
-  int32_t constexpr padding = 2;
+auto pointwise_convolution_forward(float const *__restrict__ in,
+                                   float *__restrict__ out,
+                                   float const *__restrict__ packed_kernel,
+                                   float const *__restrict__ bias,
+                                   int32_t height,
+                                   int32_t width,
+                                   int32_t channels_in,
+                                   int32_t channels_out,
+                                   int32_t blocked_in,
+                                   int32_t blocked_out) -> void
+{
+  static constexpr auto table = make_channel_table([]<int32_t fixed_channels_out>()
+                                                   { return &pointwise_convolution_forward_inner<fixed_channels_out, false>; });
+  table[channels_out](in,
+                      out,
+                      nullptr,
+                      packed_kernel,
+                      bias,
+                      height,
+                      width,
+                      channels_in,
+                      channels_out,
+                      blocked_in,
+                      blocked_out);
+}
 
-  for (int32_t h = 0; h < height; ++h)
+auto pointwise_convolution_hard_swish_forward(float const *__restrict__ in,
+                                              float *__restrict__ out,
+                                              float *__restrict__ pre_activation,
+                                              float const *__restrict__ packed_kernel,
+                                              float const *__restrict__ bias,
+                                              int32_t height,
+                                              int32_t width,
+                                              int32_t channels_in,
+                                              int32_t channels_out,
+                                              int32_t blocked_in,
+                                              int32_t blocked_out) -> void
+{
+  static constexpr auto table = make_channel_table([]<int32_t fixed_channels_out>()
+                                                   { return &pointwise_convolution_forward_inner<fixed_channels_out, true>; });
+  table[channels_out](in,
+                      out,
+                      pre_activation,
+                      packed_kernel,
+                      bias,
+                      height,
+                      width,
+                      channels_in,
+                      channels_out,
+                      blocked_in,
+                      blocked_out);
+}
+
+// pointwise_convolution_hard_swish_forward with out and pre_activation stored in half precision.
+auto pointwise_convolution_hard_swish_forward_bf16(float const *__restrict__ in,
+                                                   bfloat16 *__restrict__ out,
+                                                   bfloat16 *__restrict__ pre_activation,
+                                                   float const *__restrict__ packed_kernel,
+                                                   float const *__restrict__ bias,
+                                                   int32_t height,
+                                                   int32_t width,
+                                                   int32_t channels_in,
+                                                   int32_t channels_out,
+                                                   int32_t blocked_in,
+                                                   int32_t blocked_out) -> void
+{
+  static constexpr auto table = make_channel_table([]<int32_t fixed_channels_out>()
+                                                   { return &pointwise_convolution_forward_inner<fixed_channels_out, true, bfloat16>; });
+  table[channels_out](in,
+                      out,
+                      pre_activation,
+                      packed_kernel,
+                      bias,
+                      height,
+                      width,
+                      channels_in,
+                      channels_out,
+                      blocked_in,
+                      blocked_out);
+}
+
+template <int32_t tile_m, bool hard_swish_epilogue>
+auto quantized_pointwise_convolution_forward_tile(int8_t const *__restrict__ in,
+                                                  float *__restrict__ out,
+                                                  int8_t const *__restrict__ packed_kernel,
+                                                  float const *__restrict__ kernel_scales,
+                                                  float const *__restrict__ bias,
+                                                  float input_scale,
+                                                  int32_t channel_pairs,
+                                                  int32_t channels_out,
+                                                  int32_t columns) -> void
+{
+  // A tile_m x 8 block of int32 sums stays in registers. Every step widens one pair of input channels of each row
+  // and the matching 2 x 8 weights to int16, and multiplies them pairwise with i32x4.dot_i16x8_s.
+  v128_t acc_0[tile_m];
+  v128_t acc_1[tile_m];
+  for (int32_t m = 0; m < tile_m; ++m)
   {
-    for (int32_t w = 0; w < width; ++w)
+    acc_0[m] = wasm_i32x4_splat(0);
+    acc_1[m] = wasm_i32x4_splat(0);
+  }
+
+  for (int32_t p = 0; p < channel_pairs; ++p)
+  {
+    v128_t k_0 = wasm_i16x8_load8x8(packed_kernel + p * 16 + 0);
+    v128_t k_1 = wasm_i16x8_load8x8(packed_kernel + p * 16 + 8);
+    for (int32_t m = 0; m < tile_m; ++m)
     {
-      for (int32_t c = 0; c < channels; ++c)
-      {
-        // y[h * width * channels + w * channels + c] = b[c];
-        y[h * width * channels + w * channels + c] = 0.0f;
-      }
+      v128_t a = wasm_i16x8_extend_low_i8x16(wasm_v128_load16_splat(in + m * channel_pairs * 2 + p * 2));
+      acc_0[m] = wasm_i32x4_add(acc_0[m], wasm_i32x4_dot_i16x8(a, k_0));
+      acc_1[m] = wasm_i32x4_add(acc_1[m], wasm_i32x4_dot_i16x8(a, k_1));
     }
   }
 
-  // top left
-  for (int32_t xh = 0; xh < padding; ++xh)
+  v128_t scale_0 = wasm_f32x4_mul(load_lanes(kernel_scales + 0, columns), wasm_f32x4_splat(input_scale));
+  v128_t scale_1 = wasm_f32x4_mul(load_lanes(kernel_scales + 4, columns - 4), wasm_f32x4_splat(input_scale));
+  v128_t bias_0 = load_lanes(bias + 0, columns);
+  v128_t bias_1 = load_lanes(bias + 4, columns - 4);
+  for (int32_t m = 0; m < tile_m; ++m)
   {
-    for (int32_t xw = 0; xw < padding; ++xw)
+    v128_t value_0 = wasm_f32x4_add(wasm_f32x4_mul(wasm_f32x4_convert_i32x4(acc_0[m]), scale_0), bias_0);
+    v128_t value_1 = wasm_f32x4_add(wasm_f32x4_mul(wasm_f32x4_convert_i32x4(acc_1[m]), scale_1), bias_1);
+    if constexpr (hard_swish_epilogue)
     {
-      for (int32_t kh = padding; kh < kernel_height; ++kh)
-      {
-        for (int32_t kw = padding; kw < kernel_width; ++kw)
-        {
-          for (int32_t xc = 0; xc < channels; ++xc)
-          {
-            int32_t y_i = xh * width * channels + xw * channels + xc;
-            int32_t x_i = (xh + kh - padding) * width * channels + (xw + kw - padding) * channels + xc;
-            int32_t k_i = kh * kernel_width * channels + kw * channels + xc;
-            y[y_i] += x[x_i] * k[k_i];
-          }
-        }
-      }
+      value_0 = hard_swish(value_0);
+      value_1 = hard_swish(value_1);
     }
+    store_lanes(out + m * channels_out + 0, value_0, columns);
+    store_lanes(out + m * channels_out + 4, value_1, columns - 4);
+  }
+}
+
+template <int32_t tile_m, bool hard_swish_epilogue>
+auto quantized_pointwise_convolution_forward_rows(int8_t const *__restrict__ in,
+                                                  float *__restrict__ out,
+                                                  int8_t const *__restrict__ packed_kernel,
+                                                  float const *__restrict__ kernel_scales,
+                                                  float const *__restrict__ bias,
+                                                  float input_scale,
+                                                  int32_t channels_in,
+                                                  int32_t channels_out) -> void
+{
+  int32_t channel_pairs = (channels_in + 1) / 2;
+  for (int32_t i_n = 0; i_n < channels_out; i_n += 8)
+  {
+    quantized_pointwise_convolution_forward_tile<tile_m, hard_swish_epilogue>(in,
+                                                                              out + i_n,
+                                                                              packed_kernel + i_n * channel_pairs * 2,
+                                                                              kernel_scales + i_n,
+                                                                              bias + i_n,
+                                                                              input_scale,
+                                                                              channel_pairs,
+                                                                              channels_out,
+                                                                              min(8, channels_out - i_n));
+  }
+}
+
+// Quantizes up to 4 pixels of in starting at pixel i_m into q, each padded to an even channel count, and runs them
+// through the int8 kernel.
+template <bool hard_swish_epilogue>
+auto quantized_pointwise_convolution_forward_pixels(float const *__restrict__ in,
+                                                    float *__restrict__ out,
+                                                    int8_t *__restrict__ q,
+                                                    int8_t const *__restrict__ packed_kernel,
+                                                    float const *__restrict__ kernel_scales,
+                                                    float const *__restrict__ bias,
+                                                    float input_scale,
+                                                    int32_t rows,
+                                                    int32_t channels_in,
+                                                    int32_t channels_out) -> void
+{
+  int32_t padded_channels_in = (channels_in + 1) / 2 * 2;
+  for (int32_t m = 0; m < rows; ++m)
+  {
+    quantize_activations(in + m * channels_in, q + m * padded_channels_in, channels_in, padded_channels_in, 1.0f / input_scale);
+  }
+
+  if (rows == 4)
+  {
+    quantized_pointwise_convolution_forward_rows<4, hard_swish_epilogue>(q, out, packed_kernel, kernel_scales, bias, input_scale, channels_in, channels_out);
+    return;
+  }
+  for (int32_t m = 0; m < rows; ++m)
+  {
+    quantized_pointwise_convolution_forward_rows<1, hard_swish_epilogue>(q + m * padded_channels_in,
+                                                                         out + m * channels_out,
+                                                                         packed_kernel,
+                                                                         kernel_scales,
+                                                                         bias,
+                                                                         input_scale,
+                                                                         channels_in,
+                                                                         channels_out);
   }
+}
 
-  // top middle
-  for (int32_t xh = 0; xh < padding; ++xh)
+// Inference forward of pointwise_convolution_forward, or pointwise_convolution_hard_swish_forward with
+// hard_swish, from the kernel of quantize_pointwise_convolution_kernel. The input is quantized with input_scale,
+// 4 pixels at a time into scratch, which holds 4 * ((channels_in + 1) / 2 * 2) bytes. Both sides are NHWC.
+auto quantized_pointwise_convolution_forward(float const *__restrict__ in,
+                                             float *__restrict__ out,
+                                             int8_t const *__restrict__ packed_kernel,
+                                             float const *__restrict__ kernel_scales,
+                                             float const *__restrict__ bias,
+                                             int8_t *__restrict__ scratch,
+                                             float input_scale,
+                                             int32_t height,
+                                             int32_t width,
+                                             int32_t channels_in,
+                                             int32_t channels_out,
+                                             int32_t hard_swish) -> void
+{
+  for (int32_t i_m = 0; i_m < height * width; i_m += 4)
   {
-    for (int32_t xw = padding; xw < width - padding; ++xw)
+    int32_t rows = min(4, height * width - i_m);
+    if (hard_swish)
     {
-      for (int32_t kh = padding; kh < kernel_height; ++kh)
-      {
-        for (int32_t kw = 0; kw < kernel_width; ++kw)
-        {
-          for (int32_t xc = 0; xc < channels; ++xc)
-          {
-            int32_t y_i = xh * width * channels + xw * channels + xc;
-            int32_t x_i = (xh + kh - padding) * width * channels + (xw + kw - padding) * channels + xc;
-            int32_t k_i = kh * kernel_width * channels + kw * channels + xc;
-            y[y_i] += x[x_i] * k[k_i];
-          }
-        }
-      }
+      quantized_pointwise_convolution_forward_pixels<true>(in + i_m * channels_in,
+                                                           out + i_m * channels_out,
+                                                           scratch,
+                                                           packed_kernel,
+                                                           kernel_scales,
+                                                           bias,
+                                                           input_scale,
+                                                           rows,
+                                                           channels_in,
+                                                           channels_out);
+    }
+    else
+    {
+      quantized_pointwise_convolution_forward_pixels<false>(in + i_m * channels_in,
+                                                            out + i_m * channels_out,
+                                                            scratch,
+                                                            packed_kernel,
+                                                            kernel_scales,
+                                                            bias,
+                                                            input_scale,
+                                                            rows,
+                                                            channels_in,
+                                                            channels_out);
     }
   }
+}
+
+template <int32_t tile_m, int32_t tile_vectors>
+auto pointwise_convolution_backward_input_tile(float const *__restrict__ d_out,
+                                               float *__restrict__ d_in,
+                                               float const *__restrict__ packed_kernel_transposed,
+                                               int32_t channels_out,
+                                               tensor_layout in_layout,
+                                               tensor_layout out_layout,
+                                               int32_t accumulate) -> void
+{
+  v128_t acc[tile_m][tile_vectors];
 
-  // top right
-  for (int32_t xh = 0; xh < padding; ++xh)
+  for (int32_t m = 0; m < tile_m; ++m)
   {
-    for (int32_t xw = width - padding; xw < width; ++xw)
+    for (int32_t v = 0; v < tile_vectors; ++v)
     {
-      for (int32_t kh = padding; kh < kernel_height; ++kh)
-      {
-        for (int32_t kw = 0; kw < kernel_width - padding; ++kw)
-        {
-          for (int32_t xc = 0; xc < channels; ++xc)
-          {
-            int32_t y_i = xh * width * channels + xw * channels + xc;
-            int32_t x_i = (xh + kh - padding) * width * channels + (xw + kw - padding) * channels + xc;
-            int32_t k_i = kh * kernel_width * channels + kw * channels + xc;
-            y[y_i] += x[x_i] * k[k_i];
-          }
-        }
-      }
+      acc[m][v] = accumulate ? wasm_v128_load(d_in + in_layout.offset(m, v * 4)) : wasm_f32x4_splat(0.0f);
     }
   }
 
-  // middle left
-  for (int32_t xh = padding; xh < height - padding; ++xh)
+  for (int32_t i_k = 0; i_k < channels_out; ++i_k)
   {
-    for (int32_t xw = 0; xw < padding; ++xw)
+    v128_t k[tile_vectors];
+    for (int32_t v = 0; v < tile_vectors; ++v)
+    {
+      k[v] = wasm_v128_load(packed_kernel_transposed + i_k * 8 + v * 4);
+    }
+    float const *d_out_k = d_out + out_layout.offset(0, i_k);
+    for (int32_t m = 0; m < tile_m; ++m)
     {
-      for (int32_t kh = 0; kh < kernel_height; ++kh)
+      v128_t a = wasm_v128_load32_splat(d_out_k + m * out_layout.pixel_stride);
+      for (int32_t v = 0; v < tile_vectors; ++v)
       {
-        for (int32_t kw = padding; kw < kernel_width; ++kw)
-        {
-          for (int32_t xc = 0; xc < channels; ++xc)
-          {
-            int32_t y_i = xh * width * channels + xw * channels + xc;
-            int32_t x_i = (xh + kh - padding) * width * channels + (xw + kw - padding) * channels + xc;
-            int32_t k_i = kh * kernel_width * channels + kw * channels + xc;
-            y[y_i] += x[x_i] * k[k_i];
-          }
-        }
+        acc[m][v] = wasm_f32x4_add(acc[m][v], wasm_f32x4_mul(a, k[v]));
       }
     }
   }
 
-  // middle middle
-  for (int32_t xh = padding; xh < height - padding; ++xh)
+  for (int32_t m = 0; m < tile_m; ++m)
   {
-    for (int32_t xw = padding; xw < width - padding; ++xw)
+    for (int32_t v = 0; v < tile_vectors; ++v)
+    {
+      wasm_v128_store(d_in + in_layout.offset(m, v * 4), acc[m][v]);
+    }
+  }
+}
+
+template <int32_t tile_m>
+auto pointwise_convolution_backward_input_rows(float const *__restrict__ d_out,
+                                               float *__restrict__ d_in,
+                                               float const *__restrict__ packed_kernel_transposed,
+                                               int32_t channels_in,
+                                               int32_t channels_out,
+                                               tensor_layout in_layout,
+                                               tensor_layout out_layout,
+                                               int32_t accumulate) -> void
+{
+  int32_t i_n = 0;
+  for (; i_n + 8 <= channels_in; i_n += 8)
+  {
+    pointwise_convolution_backward_input_tile<tile_m, 2>(d_out,
+                                                         d_in + in_layout.offset(0, i_n),
+                                                         packed_kernel_transposed + i_n * channels_out,
+                                                         channels_out,
+                                                         in_layout,
+                                                         out_layout,
+                                                         accumulate);
+  }
+  for (; i_n + 4 <= channels_in; i_n += 4)
+  {
+    pointwise_convolution_backward_input_tile<tile_m, 1>(d_out,
+                                                         d_in + in_layout.offset(0, i_n),
+                                                         packed_kernel_transposed + i_n * channels_out,
+                                                         channels_out,
+                                                         in_layout,
+                                                         out_layout,
+                                                         accumulate);
+  }
+  for (; i_n < channels_in; ++i_n)
+  {
+    for (int32_t m = 0; m < tile_m; ++m)
     {
-      for (int32_t kh = 0; kh < kernel_height; ++kh)
+      float acc = accumulate ? d_in[in_layout.offset(m, i_n)] : 0.0f;
+      for (int32_t i_k = 0; i_k < channels_out; ++i_k)
       {
-        for (int32_t kw = 0; kw < kernel_width; ++kw)
-        {
-          for (int32_t xc = 0; xc < channels; ++xc)
-          {
-            int32_t y_i = xh * width * channels + xw * channels + xc;
-            int32_t x_i = (xh + kh - padding) * width * channels + (xw + kw - padding) * channels + xc;
-            int32_t k_i = kh * kernel_width * channels + kw * channels + xc;
-            y[y_i] += x[x_i] * k[k_i];
-          }
-        }
+        float k = packed_kernel_transposed[(i_n / 8) * 8 * channels_out + i_k * 8 + i_n % 8];
+        acc += d_out[out_layout.offset(m, i_k)] * k;
       }
+      d_in[in_layout.offset(m, i_n)] = acc;
     }
   }
+}
+
+template <int32_t tile_k>
+auto pointwise_convolution_backward_kernel_tile(float const *__restrict__ d_out,
+                                                float *__restrict__ d_kernel,
+                                                float const *__restrict__ in,
+                                                int32_t size,
+                                                int32_t channels_out,
+                                                tensor_layout in_layout,
+                                                tensor_layout out_layout,
+                                                int32_t columns) -> void
+{
+  // A tile_k x 8 block of d_kernel is accumulated in registers over every pixel of the tile.
+  v128_t acc_0[tile_k];
+  v128_t acc_1[tile_k];
+  for (int32_t k = 0; k < tile_k; ++k)
+  {
+    acc_0[k] = load_lanes(d_kernel + k * channels_out + 0, columns);
+    acc_1[k] = load_lanes(d_kernel + k * channels_out + 4, columns - 4);
+  }
 
-  // middle right
-  for (int32_t xh = padding; xh < height - padding; ++xh)
+  for (int32_t m = 0; m < size; ++m)
   {
-    for (int32_t xw = width - padding; xw < width; ++xw)
+    v128_t d_0 = load_lanes(d_out + out_layout.offset(m, 0), columns);
+    v128_t d_1 = load_lanes(d_out + out_layout.offset(m, 4), columns - 4);
+    for (int32_t k = 0; k < tile_k; ++k)
     {
-      for (int32_t kh = 0; kh < kernel_height; ++kh)
-      {
-        for (int32_t kw = 0; kw < kernel_width - padding; ++kw)
-        {
-          for (int32_t xc = 0; xc < channels; ++xc)
-          {
-            int32_t y_i = xh * width * channels + xw * channels + xc;
-            int32_t x_i = (xh + kh - padding) * width * channels + (xw + kw - padding) * channels + xc;
-            int32_t k_i = kh * kernel_width * channels + kw * channels + xc;
-            y[y_i] += x[x_i] * k[k_i];
-          }
-        }
-      }
+      v128_t a = wasm_v128_load32_splat(in + in_layout.offset(m, k));
+      acc_0[k] = wasm_f32x4_add(acc_0[k], wasm_f32x4_mul(a, d_0));
+      acc_1[k] = wasm_f32x4_add(acc_1[k], wasm_f32x4_mul(a, d_1));
     }
   }
 
-  // bottom left
-  for (int32_t xh = height - padding; xh < height; ++xh)
+  for (int32_t k = 0; k < tile_k; ++k)
+  {
+    store_lanes(d_kernel + k * channels_out + 0, acc_0[k], columns);
+    store_lanes(d_kernel + k * channels_out + 4, acc_1[k], columns - 4);
+  }
+}
+
+template <int32_t tile_k>
+auto pointwise_convolution_backward_kernel_rows(float const *__restrict__ d_out,
+                                                float *__restrict__ d_kernel,
+                                                float const *__restrict__ in,
+                                                int32_t size,
+                                                int32_t channels_out,
+                                                tensor_layout in_layout,
+                                                tensor_layout out_layout) -> void
+{
+  int32_t i_n = 0;
+  for (; i_n + 8 <= channels_out; i_n += 8)
+  {
+    pointwise_convolution_backward_kernel_tile<tile_k>(d_out + out_layout.offset(0, i_n),
+                                                       d_kernel + i_n,
+                                                       in,
+                                                       size,
+                                                       channels_out,
+                                                       in_layout,
+                                                       out_layout,
+                                                       8);
+  }
+  if (i_n < channels_out)
+  {
+    pointwise_convolution_backward_kernel_tile<tile_k>(d_out + out_layout.offset(0, i_n),
+                                                       d_kernel + i_n,
+                                                       in,
+                                                       size,
+                                                       channels_out,
+                                                       in_layout,
+                                                       out_layout,
+                                                       channels_out - i_n);
+  }
+}
+
+template <int32_t fixed_channels_out, bool hard_swish_epilogue, typename T = float>
+auto pointwise_convolution_backward_inner(float const *__restrict__ d_out,
+                                          float *__restrict__ d_in,
+                                          float *__restrict__ d_kernel,
+                                          float *__restrict__ d_bias,
+                                          float const *__restrict__ in,
+                                          T const *__restrict__ pre_activation,
+                                          float *__restrict__ d_pre_activation,
+                                          float const *__restrict__ packed_kernel_transposed,
+                                          int32_t height,
+                                          int32_t width,
+                                          int32_t channels_in,
+                                          int32_t channels_out,
+                                          int32_t blocked_in,
+                                          int32_t blocked_out,
+                                          int32_t accumulate) -> void
+{
+  channels_out = channel_count<fixed_channels_out>(channels_out);
+
+  int32_t constexpr tile_size = 32;
+
+  tensor_layout in_layout = make_tensor_layout(blocked_in, height * width, channels_in);
+  tensor_layout out_layout = make_tensor_layout(blocked_out, height * width, channels_out);
+
+  // The gradient with respect to the pre-activation is materialized per tile in NHWC whatever the output layout.
+  tensor_layout d_out_layout = hard_swish_epilogue ? nhwc_layout(channels_out) : out_layout;
+
+  // Each tile of d_out is read while it is still in cache by all three gradient computations.
+  for (int32_t tile_start = 0; tile_start < height * width; tile_start += tile_size)
   {
-    for (int32_t xw = 0; xw < padding; ++xw)
+    int32_t size = min(tile_size, height * width - tile_start);
+
+    float const *d_out_tile = d_out + out_layout.offset(tile_start, 0);
+    float const *in_tile = in + in_layout.offset(tile_start, 0);
+
+    if constexpr (hard_swish_epilogue)
     {
-      for (int32_t kh = 0; kh < kernel_height - padding; ++kh)
+      // Only one tile of the gradient with respect to the pre-activation is ever materialized.
+      T const *pre_activation_tile = pre_activation + out_layout.offset(tile_start, 0);
+      if (!blocked_out)
+      {
+        for (int32_t i = 0; i < size * channels_out; i += 4)
+        {
+          v128_t derivative = hard_swish_derivative(load_lanes(pre_activation_tile + i, size * channels_out - i));
+          store_lanes(d_pre_activation + i, wasm_f32x4_mul(derivative, load_lanes(d_out_tile + i, size * channels_out - i)), size * channels_out - i);
+        }
+      }
+      else
       {
-        for (int32_t kw = padding; kw < kernel_width; ++kw)
+        for (int32_t m = 0; m < size; ++m)
         {
-          for (int32_t xc = 0; xc < channels; ++xc)
+          for (int32_t i_n = 0; i_n < channels_out; i_n += 4)
           {
-            int32_t y_i = xh * width * channels + xw * channels + xc;
-            int32_t x_i = (xh + kh - padding) * width * channels + (xw + kw - padding) * channels + xc;
-            int32_t k_i = kh * kernel_width * channels + kw * channels + xc;
-            y[y_i] += x[x_i] * k[k_i];
+            int32_t lanes = min(4, channels_out - i_n);
+            v128_t derivative = hard_swish_derivative(load_lanes(pre_activation_tile + out_layout.offset(m, i_n), lanes));
+            v128_t d = wasm_f32x4_mul(derivative, load_lanes(d_out_tile + out_layout.offset(m, i_n), lanes));
+            store_lanes(d_pre_activation + m * channels_out + i_n, d, lanes);
           }
         }
       }
+      d_out_tile = d_pre_activation;
     }
-  }
 
-  // bottom middle
-  for (int32_t xh = height - padding; xh < height; ++xh)
-  {
-    for (int32_t xw = padding; xw < width - padding; ++xw)
+    for (int32_t i_n = 0; i_n < channels_out; i_n += 4)
     {
-      for (int32_t kh = 0; kh < kernel_height - padding; ++kh)
+      v128_t acc = load_lanes(d_bias + i_n, channels_out - i_n);
+      for (int32_t m = 0; m < size; ++m)
       {
-        for (int32_t kw = 0; kw < kernel_width; ++kw)
-        {
-          for (int32_t xc = 0; xc < channels; ++xc)
-          {
-            int32_t y_i = xh * width * channels + xw * channels + xc;
-            int32_t x_i = (xh + kh - padding) * width * channels + (xw + kw - padding) * channels + xc;
-            int32_t k_i = kh * kernel_width * channels + kw * channels + xc;
-            y[y_i] += x[x_i] * k[k_i];
-          }
-        }
+        acc = wasm_f32x4_add(acc, load_lanes(d_out_tile + d_out_layout.offset(m, i_n), channels_out - i_n));
       }
+      store_lanes(d_bias + i_n, acc, channels_out - i_n);
     }
-  }
 
-  // bottom right
-  for (int32_t xh = height - padding; xh < height; ++xh)
-  {
-    for (int32_t xw = width - padding; xw < width; ++xw)
+    // A null d_in means nothing upstream consumes the input gradient, so it is not computed.
+    if (d_in != nullptr)
     {
-      for (int32_t kh = 0; kh < kernel_height - padding; ++kh)
+      float *d_in_tile = d_in + in_layout.offset(tile_start, 0);
+
+      int32_t m = 0;
+      for (; m + 4 <= size; m += 4)
       {
-        for (int32_t kw = 0; kw < kernel_width - padding; ++kw)
-        {
-          for (int32_t xc = 0; xc < channels; ++xc)
-          {
-            int32_t y_i = xh * width * channels + xw * channels + xc;
-            int32_t x_i = (xh + kh - padding) * width * channels + (xw + kw - padding) * channels + xc;
-            int32_t k_i = kh * kernel_width * channels + kw * channels + xc;
-            y[y_i] += x[x_i] * k[k_i];
-          }
-        }
+        pointwise_convolution_backward_input_rows<4>(d_out_tile + d_out_layout.offset(m, 0),
+                                                     d_in_tile + in_layout.offset(m, 0),
+                                                     packed_kernel_transposed,
+                                                     channels_in,
+                                                     channels_out,
+                                                     in_layout,
+                                                     d_out_layout,
+                                                     accumulate);
       }
+      for (; m < size; ++m)
+      {
+        pointwise_convolution_backward_input_rows<1>(d_out_tile + d_out_layout.offset(m, 0),
+                                                     d_in_tile + in_layout.offset(m, 0),
+                                                     packed_kernel_transposed,
+                                                     channels_in,
+                                                     channels_out,
+                                                     in_layout,
+                                                     d_out_layout,
+                                                     accumulate);
+      }
+    }
+
+    int32_t k = 0;
+    for (; k + 4 <= channels_in; k += 4)
+    {
+      pointwise_convolution_backward_kernel_rows<4>(d_out_tile,
+                                                    d_kernel + k * channels_out,
+                                                    in_tile + in_layout.offset(0, k),
+                                                    size,
+                                                    channels_out,
+                                                    in_layout,
+                                                    d_out_layout);
+    }
+    for (; k < channels_in; ++k)
+    {
+      pointwise_convolution_backward_kernel_rows<1>(d_out_tile,
+                                                    d_kernel + k * channels_out,
+                                                    in_tile + in_layout.offset(0, k),
+                                                    size,
+                                                    channels_out,
+                                                    in_layout,
+                                                    d_out_layout);
     }
   }
 }
 
-auto depthwise_convolution_forward(float const *__restrict__ x,
-                                   float *__restrict__ y,
-                                   float const *__restrict__ k,
-                                   float const *__restrict__ b,
-                                   int32_t height,
-                                   int32_t width,
-                                   int32_t channels) -> void
+auto pointwise_convolution_backward(float const *__restrict__ d_out,
+                                    float *__restrict__ d_in,
+                                    float *__restrict__ d_kernel,
+                                    float *__restrict__ d_bias,
+                                    float const *__restrict__ in,
+                                    float const *__restrict__ packed_kernel_transposed,
+                                    int32_t height,
+                                    int32_t width,
+                                    int32_t channels_in,
+                                    int32_t channels_out,
+                                    int32_t blocked_in,
+                                    int32_t blocked_out,
+                                    int32_t accumulate) -> void
+{
+  static constexpr auto table = make_channel_table([]<int32_t fixed_channels_out>()
+                                                   { return &pointwise_convolution_backward_inner<fixed_channels_out, false>; });
+  table[channels_out](d_out,
+                      d_in,
+                      d_kernel,
+                      d_bias,
+                      in,
+                      nullptr,
+                      nullptr,
+                      packed_kernel_transposed,
+                      height,
+                      width,
+                      channels_in,
+                      channels_out,
+                      blocked_in,
+                      blocked_out,
+                      accumulate);
+}
+
+auto pointwise_convolution_hard_swish_backward(float const *__restrict__ d_out,
+                                               float *__restrict__ d_in,
+                                               float *__restrict__ d_kernel,
+                                               float *__restrict__ d_bias,
+                                               float const *__restrict__ in,
+                                               float const *__restrict__ pre_activation,
+                                               float *__restrict__ d_pre_activation,
+                                               float const *__restrict__ packed_kernel_transposed,
+                                               int32_t height,
+                                               int32_t width,
+                                               int32_t channels_in,
+                                               int32_t channels_out,
+                                               int32_t blocked_in,
+                                               int32_t blocked_out,
+                                               int32_t accumulate) -> void
+{
+  static constexpr auto table = make_channel_table([]<int32_t fixed_channels_out>()
+                                                   { return &pointwise_convolution_backward_inner<fixed_channels_out, true>; });
+  table[channels_out](d_out,
+                      d_in,
+                      d_kernel,
+                      d_bias,
+                      in,
+                      pre_activation,
+                      d_pre_activation,
+                      packed_kernel_transposed,
+                      height,
+                      width,
+                      channels_in,
+                      channels_out,
+                      blocked_in,
+                      blocked_out,
+                      accumulate);
+}
+
+// pointwise_convolution_hard_swish_backward with the pre_activation of pointwise_convolution_hard_swish_forward_bf16.
+auto pointwise_convolution_hard_swish_backward_bf16(float const *__restrict__ d_out,
+                                                    float *__restrict__ d_in,
+                                                    float *__restrict__ d_kernel,
+                                                    float *__restrict__ d_bias,
+                                                    float const *__restrict__ in,
+                                                    bfloat16 const *__restrict__ pre_activation,
+                                                    float *__restrict__ d_pre_activation,
+                                                    float const *__restrict__ packed_kernel_transposed,
+                                                    int32_t height,
+                                                    int32_t width,
+                                                    int32_t channels_in,
+                                                    int32_t channels_out,
+                                                    int32_t blocked_in,
+                                                    int32_t blocked_out,
+                                                    int32_t accumulate) -> void
+{
+  static constexpr auto table = make_channel_table([]<int32_t fixed_channels_out>()
+                                                   { return &pointwise_convolution_backward_inner<fixed_channels_out, true, bfloat16>; });
+  table[channels_out](d_out,
+                      d_in,
+                      d_kernel,
+                      d_bias,
+                      in,
+                      pre_activation,
+                      d_pre_activation,
+                      packed_kernel_transposed,
+                      height,
+                      width,
+                      channels_in,
+                      channels_out,
+                      blocked_in,
+                      blocked_out,
+                      accumulate);
+}
+
+// Folds the rows outputs of the pointwise convolution of pointwise_convolution_pixel_shuffle_argmax that start at
+// pixel i_m, held in scratch, into the running maxima. They are scanned in the shuffled coordinates of
+// pixel_shuffle_forward, and ties go to the lowest shuffled index, like a raster-order scan.
+template <int32_t fixed_channels_out>
+auto pixel_shuffle_argmax_rows(float const *__restrict__ scratch,
+                               float *__restrict__ peak_values,
+                               int32_t *__restrict__ peak_indices,
+                               int32_t i_m,
+                               int32_t rows,
+                               int32_t height,
+                               int32_t width,
+                               int32_t channels_out,
+                               int32_t within_circle) -> void
+{
+  channels_out = channel_count<fixed_channels_out>(channels_out);
+
+  int32_t constexpr scale = 4;
+
+  int32_t channels_shuffled = channels_out / square(scale);
+  int32_t y_height = height * scale;
+  int32_t y_width = width * scale;
+
+  // The circle matches argmaxWithinCircle in image.js, which takes the height as the side of a square map and
+  // centers the circle at half of it on both axes, also for maps that are not square.
+  float center_h = y_height / 2.0f;
+  float center_w = y_height / 2.0f;
+  float radius = (y_height + 1) / 2;
+
+  for (int32_t m = 0; m < rows; ++m)
+  {
+    int32_t h = (i_m + m) / width;
+    int32_t w = (i_m + m) % width;
+    for (int32_t i = 0; i < scale; ++i)
+    {
+      for (int32_t j = 0; j < scale; ++j)
+      {
+        int32_t y_h = h * scale + i;
+        int32_t y_w = w * scale + j;
+        if (within_circle && square(y_h - center_h) + square(y_w - center_w) > square(radius))
+        {
+          continue;
+        }
+
+        int32_t index = y_h * y_width + y_w;
+        for (int32_t c = 0; c < channels_shuffled; ++c)
+        {
+          float value = scratch[m * channels_out + c * square(scale) + i * scale + j];
+          if (value > peak_values[c] || (value == peak_values[c] && index < peak_indices[c]))
+          {
+            peak_values[c] = value;
+            peak_indices[c] = index;
+          }
+        }
+      }
+    }
+  }
+}
+
+template <int32_t fixed_channels_out>
+auto pointwise_convolution_pixel_shuffle_argmax_inner(float const *__restrict__ in,
+                                                      float const *__restrict__ packed_kernel,
+                                                      float const *__restrict__ bias,
+                                                      float *__restrict__ scratch,
+                                                      float *__restrict__ peak_values,
+                                                      int32_t *__restrict__ peak_indices,
+                                                      int32_t height,
+                                                      int32_t width,
+                                                      int32_t channels_in,
+                                                      int32_t channels_out,
+                                                      int32_t within_circle) -> void
+{
+  channels_out = channel_count<fixed_channels_out>(channels_out);
+
+  int32_t constexpr tile_m = 4;
+
+  for (int32_t c = 0; c < channels_out / 16; ++c)
+  {
+    peak_values[c] = -__builtin_inff();
+    peak_indices[c] = -1;
+  }
+
+  // Each tile of outputs is only ever held in scratch (tile_m x channels_out).
+  for (int32_t i_m = 0; i_m < height * width; i_m += tile_m)
+  {
+    int32_t rows = min(tile_m, height * width - i_m);
+    if (rows == tile_m)
+    {
+      pointwise_convolution_forward_rows<tile_m, false>(in + i_m * channels_in,
+                                                        scratch,
+                                                        nullptr,
+                                                        packed_kernel,
+                                                        bias,
+                                                        channels_in,
+                                                        channels_out,
+                                                        nhwc_layout(channels_in),
+                                                        nhwc_layout(channels_out));
+    }
+    else
+    {
+      for (int32_t m = 0; m < rows; ++m)
+      {
+        pointwise_convolution_forward_rows<1, false>(in + (i_m + m) * channels_in,
+                                                     scratch + m * channels_out,
+                                                     nullptr,
+                                                     packed_kernel,
+                                                     bias,
+                                                     channels_in,
+                                                     channels_out,
+                                                     nhwc_layout(channels_in),
+                                                     nhwc_layout(channels_out));
+      }
+    }
+
+    pixel_shuffle_argmax_rows<fixed_channels_out>(scratch, peak_values, peak_indices, i_m, rows, height, width, channels_out, within_circle);
+  }
+}
+
+// pointwise_convolution_forward followed by pixel_shuffle_forward with a scale of 4, reduced to the maximum
+// of every shuffled channel and its index in the (height * 4) x (width * 4) map. The maps themselves are
+// never written. scratch holds 4 x channels_out values.
+auto pointwise_convolution_pixel_shuffle_argmax(float const *__restrict__ in,
+                                                float const *__restrict__ packed_kernel,
+                                                float const *__restrict__ bias,
+                                                float *__restrict__ scratch,
+                                                float *__restrict__ peak_values,
+                                                int32_t *__restrict__ peak_indices,
+                                                int32_t height,
+                                                int32_t width,
+                                                int32_t channels_in,
+                                                int32_t channels_out,
+                                                int32_t within_circle) -> void
+{
+  static constexpr auto table = make_channel_table([]<int32_t fixed_channels_out>()
+                                                   { return &pointwise_convolution_pixel_shuffle_argmax_inner<fixed_channels_out>; });
+  table[channels_out](in,
+                      packed_kernel,
+                      bias,
+                      scratch,
+                      peak_values,
+                      peak_indices,
+                      height,
+                      width,
+                      channels_in,
+                      channels_out,
+                      within_circle);
+}
+
+// pointwise_convolution_pixel_shuffle_argmax with the kernel of quantize_pointwise_convolution_kernel, as in
+// quantized_pointwise_convolution_forward. scratch holds 4 x channels_out values followed by
+// 4 * ((channels_in + 1) / 2 * 2) bytes for the quantized input.
+auto quantized_pointwise_convolution_pixel_shuffle_argmax(float const *__restrict__ in,
+                                                          int8_t const *__restrict__ packed_kernel,
+                                                          float const *__restrict__ kernel_scales,
+                                                          float const *__restrict__ bias,
+                                                          float *__restrict__ scratch,
+                                                          float *__restrict__ peak_values,
+                                                          int32_t *__restrict__ peak_indices,
+                                                          float input_scale,
+                                                          int32_t height,
+                                                          int32_t width,
+                                                          int32_t channels_in,
+                                                          int32_t channels_out,
+                                                          int32_t within_circle) -> void
+{
+  int8_t *q = reinterpret_cast<int8_t *>(scratch + 4 * channels_out);
+
+  for (int32_t c = 0; c < channels_out / 16; ++c)
+  {
+    peak_values[c] = -__builtin_inff();
+    peak_indices[c] = -1;
+  }
+
+  for (int32_t i_m = 0; i_m < height * width; i_m += 4)
+  {
+    int32_t rows = min(4, height * width - i_m);
+    quantized_pointwise_convolution_forward_pixels<false>(in + i_m * channels_in,
+                                                          scratch,
+                                                          q,
+                                                          packed_kernel,
+                                                          kernel_scales,
+                                                          bias,
+                                                          input_scale,
+                                                          rows,
+                                                          channels_in,
+                                                          channels_out);
+    pixel_shuffle_argmax_rows<0>(scratch, peak_values, peak_indices, i_m, rows, height, width, channels_out, within_circle);
+  }
+}
+
+// The backward of a pointwise convolution followed by pixel_shuffle_forward, for a d_y that is zero outside the
+// listed rows of the convolution output (as written by sparse_mean_squared_error_forward_backward). Each tile of
+// rows is gathered into scratch (tile_size x (channels_out + 2 channels_in)) and run through the dense kernels.
+auto pointwise_convolution_pixel_shuffle_backward_sparse(float const *__restrict__ d_y,
+                                                         float *__restrict__ d_in,
+                                                         float *__restrict__ d_kernel,
+                                                         float *__restrict__ d_bias,
+                                                         float const *__restrict__ in,
+                                                         float const *__restrict__ packed_kernel_transposed,
+                                                         float *__restrict__ scratch,
+                                                         int32_t const *__restrict__ rows,
+                                                         int32_t row_count,
+                                                         int32_t height,
+                                                         int32_t width,
+                                                         int32_t channels_in,
+                                                         int32_t channels_out,
+                                                         int32_t accumulate) -> void
+{
+  int32_t constexpr scale = 4;
+  int32_t constexpr tile_size = 32;
+
+  int32_t channels_shuffled = channels_out / square(scale);
+
+  float *d_out_tile = scratch;
+  float *in_tile = d_out_tile + tile_size * channels_out;
+  float *d_in_tile = in_tile + tile_size * channels_in;
+
+  // The input gradient of every row that isn't listed is zero.
+  if (d_in != nullptr && !accumulate)
+  {
+    zero(d_in, height * width * channels_in);
+  }
+
+  for (int32_t tile_start = 0; tile_start < row_count; tile_start += tile_size)
+  {
+    int32_t size = min(tile_size, row_count - tile_start);
+
+    for (int32_t m = 0; m < size; ++m)
+    {
+      int32_t row = rows[tile_start + m];
+      int32_t h = row / width;
+      int32_t w = row % width;
+
+      for (int32_t c = 0; c < channels_shuffled; ++c)
+      {
+        for (int32_t i = 0; i < scale; ++i)
+        {
+          for (int32_t j = 0; j < scale; ++j)
+          {
+            int32_t d_y_i = ((h * scale + i) * width * scale + w * scale + j) * channels_shuffled + c;
+            d_out_tile[m * channels_out + c * scale * scale + i * scale + j] = d_y[d_y_i];
+          }
+        }
+      }
+
+      for (int32_t k = 0; k < channels_in; k += 4)
+      {
+        store_lanes(in_tile + m * channels_in + k, load_lanes(in + row * channels_in + k, channels_in - k), channels_in - k);
+      }
+    }
+
+    for (int32_t i_n = 0; i_n < channels_out; i_n += 4)
+    {
+      v128_t acc = load_lanes(d_bias + i_n, channels_out - i_n);
+      for (int32_t m = 0; m < size; ++m)
+      {
+        acc = wasm_f32x4_add(acc, load_lanes(d_out_tile + m * channels_out + i_n, channels_out - i_n));
+      }
+      store_lanes(d_bias + i_n, acc, channels_out - i_n);
+    }
+
+    if (d_in != nullptr)
+    {
+      int32_t m = 0;
+      for (; m + 4 <= size; m += 4)
+      {
+        pointwise_convolution_backward_input_rows<4>(d_out_tile + m * channels_out,
+                                                     d_in_tile + m * channels_in,
+                                                     packed_kernel_transposed,
+                                                     channels_in,
+                                                     channels_out,
+                                                     nhwc_layout(channels_in),
+                                                     nhwc_layout(channels_out),
+                                                     0);
+      }
+      for (; m < size; ++m)
+      {
+        pointwise_convolution_backward_input_rows<1>(d_out_tile + m * channels_out,
+                                                     d_in_tile + m * channels_in,
+                                                     packed_kernel_transposed,
+                                                     channels_in,
+                                                     channels_out,
+                                                     nhwc_layout(channels_in),
+                                                     nhwc_layout(channels_out),
+                                                     0);
+      }
+
+      for (m = 0; m < size; ++m)
+      {
+        float *d_in_row = d_in + rows[tile_start + m] * channels_in;
+        for (int32_t k = 0; k < channels_in; k += 4)
+        {
+          v128_t value = wasm_f32x4_add(load_lanes(d_in_row + k, channels_in - k), load_lanes(d_in_tile + m * channels_in + k, channels_in - k));
+          store_lanes(d_in_row + k, value, channels_in - k);
+        }
+      }
+    }
+
+    int32_t k = 0;
+    for (; k + 4 <= channels_in; k += 4)
+    {
+      pointwise_convolution_backward_kernel_rows<4>(d_out_tile,
+                                                    d_kernel + k * channels_out,
+                                                    in_tile + k,
+                                                    size,
+                                                    channels_out,
+                                                    nhwc_layout(channels_in),
+                                                    nhwc_layout(channels_out));
+    }
+    for (; k < channels_in; ++k)
+    {
+      pointwise_convolution_backward_kernel_rows<1>(d_out_tile,
+                                                    d_kernel + k * channels_out,
+                                                    in_tile + k,
+                                                    size,
+                                                    channels_out,
+                                                    nhwc_layout(channels_in),
+                                                    nhwc_layout(channels_out));
+    }
+  }
+}
+
+template <typename T, int32_t pixel_stride>
+auto pixel_unshuffle_gather(T const *__restrict__ x,
+                            float *__restrict__ patch,
+                            int32_t x_width) -> void
+{
+  int32_t constexpr scale = 8;
+
+  // One scale x scale patch of x becomes one pixel of the unshuffled tensor, in the channel order of
+  // pixel_unshuffle_forward.
+  for (int32_t r = 0; r < scale; ++r)
+  {
+    for (int32_t s = 0; s < scale; ++s)
+    {
+      for (int32_t c = 0; c < channels_rgb; ++c)
+      {
+        patch[c * square(scale) + r * scale + s] = static_cast<float>(x[(r * x_width + s) * pixel_stride + c]);
+      }
+    }
+  }
+}
+
+template <int32_t fixed_channels_out, typename T, int32_t pixel_stride>
+auto pixel_unshuffle_pointwise_convolution_forward_inner(T const *__restrict__ x,
+                                                         float *__restrict__ y,
+                                                         float *__restrict__ unshuffled,
+                                                         float const *__restrict__ packed_kernel,
+                                                         float const *__restrict__ bias,
+                                                         int32_t height,
+                                                         int32_t width,
+                                                         int32_t channels_out) -> void
+{
+  channels_out = channel_count<fixed_channels_out>(channels_out);
+
+  int32_t constexpr scale = 8;
+  int32_t constexpr channels_in = channels_rgb * square(scale);
+  int32_t constexpr tile_m = 4;
+
+  // Patches are gathered tile_m at a time into a buffer that stays in L1 and multiplied right away, so the
+  // full-resolution input is read once and the unshuffled tensor is only written when backward needs it.
+  alignas(16) float patches[tile_m * channels_in];
+
+  for (int32_t h = 0; h < height; ++h)
+  {
+    T const *x_row = x + h * scale * (width * scale) * pixel_stride;
+
+    int32_t w = 0;
+    for (; w + tile_m <= width; w += tile_m)
+    {
+      float *in = unshuffled != nullptr ? unshuffled + (h * width + w) * channels_in : patches;
+      for (int32_t m = 0; m < tile_m; ++m)
+      {
+        pixel_unshuffle_gather<T, pixel_stride>(x_row + (w + m) * scale * pixel_stride, in + m * channels_in, width * scale);
+      }
+      pointwise_convolution_forward_rows<tile_m, false>(in,
+                                                        y + (h * width + w) * channels_out,
+                                                        nullptr,
+                                                        packed_kernel,
+                                                        bias,
+                                                        channels_in,
+                                                        channels_out,
+                                                        nhwc_layout(channels_in),
+                                                        nhwc_layout(channels_out));
+    }
+    for (; w < width; ++w)
+    {
+      float *in = unshuffled != nullptr ? unshuffled + (h * width + w) * channels_in : patches;
+      pixel_unshuffle_gather<T, pixel_stride>(x_row + w * scale * pixel_stride, in, width * scale);
+      pointwise_convolution_forward_rows<1, false>(in,
+                                                   y + (h * width + w) * channels_out,
+                                                   nullptr,
+                                                   packed_kernel,
+                                                   bias,
+                                                   channels_in,
+                                                   channels_out,
+                                                   nhwc_layout(channels_in),
+                                                   nhwc_layout(channels_out));
+    }
+  }
+}
+
+// pixel_unshuffle_forward with a scale of 8 followed by pointwise_convolution_forward, for an RGB input of
+// (height * 8) x (width * 8) pixels. unshuffled is optional and receives the intermediate tensor.
+auto pixel_unshuffle_pointwise_convolution_forward(float const *__restrict__ x,
+                                                   float *__restrict__ y,
+                                                   float *__restrict__ unshuffled,
+                                                   float const *__restrict__ packed_kernel,
+                                                   float const *__restrict__ bias,
+                                                   int32_t height,
+                                                   int32_t width,
+                                                   int32_t channels_out) -> void
+{
+  static constexpr auto table = make_channel_table([]<int32_t fixed_channels_out>()
+                                                   { return &pixel_unshuffle_pointwise_convolution_forward_inner<fixed_channels_out, float, channels_rgb>; });
+  table[channels_out](x,
+                      y,
+                      unshuffled,
+                      packed_kernel,
+                      bias,
+                      height,
+                      width,
+                      channels_out);
+}
+
+// Same as pixel_unshuffle_pointwise_convolution_forward, but reading 8-bit RGBA pixels. The alpha channel is
+// skipped and the 1 / 255 normalization is expected to be folded into packed_kernel.
+auto pixel_unshuffle_pointwise_convolution_rgba_forward(uint8_t const *__restrict__ x,
+                                                        float *__restrict__ y,
+                                                        float const *__restrict__ packed_kernel,
+                                                        float const *__restrict__ bias,
+                                                        int32_t height,
+                                                        int32_t width,
+                                                        int32_t channels_out) -> void
+{
+  static constexpr auto table = make_channel_table([]<int32_t fixed_channels_out>()
+                                                   { return &pixel_unshuffle_pointwise_convolution_forward_inner<fixed_channels_out, uint8_t, channels_rgba>; });
+  table[channels_out](x,
+                      y,
+                      nullptr,
+                      packed_kernel,
+                      bias,
+                      height,
+                      width,
+                      channels_out);
+}
+
+template <int32_t padding, int32_t dilation, typename T>
+auto depthwise_convolution_load_row(T const *__restrict__ x,
+                                    float *__restrict__ row,
+                                    int32_t h,
+                                    int32_t height,
+                                    int32_t width,
+                                    int32_t channels) -> void
+{
+  int32_t padded_channels = (channels + 3) / 4 * 4;
+
+  // Rows above and below the image, the left and right padding and the lanes past channels are all zero,
+  // so the kernel never needs to special-case a border. With a dilation above 1, x is the strided output
+  // grid and its pixels are spread out over the height x width grid with zeros in between.
+  if (h < 0 || h >= height || h % dilation != 0)
+  {
+    for (int32_t i = 0; i < (width + 2 * padding) * padded_channels; ++i)
+    {
+      row[i] = 0.0f;
+    }
+    return;
+  }
+
+  int32_t x_w = (width + dilation - 1) / dilation;
+
+  for (int32_t i = 0; i < padding * padded_channels; ++i)
+  {
+    row[i] = 0.0f;
+    row[(width + padding) * padded_channels + i] = 0.0f;
+  }
+  for (int32_t w = 0; w < width; ++w)
+  {
+    float *__restrict__ row_w = row + (w + padding) * padded_channels;
+    if (w % dilation != 0)
+    {
+      for (int32_t c = 0; c < padded_channels; ++c)
+      {
+        row_w[c] = 0.0f;
+      }
+      continue;
+    }
+    for (int32_t c = 0; c < channels; ++c)
+    {
+      row_w[c] = to_float(x[(h / dilation) * x_w * channels + (w / dilation) * channels + c]);
+    }
+    for (int32_t c = channels; c < padded_channels; ++c)
+    {
+      row_w[c] = 0.0f;
+    }
+  }
+}
+
+template <int32_t kernel_size, int32_t dilation, typename T>
+auto depthwise_convolution_start_rows(T const *__restrict__ x,
+                                      float *__restrict__ row_buffer,
+                                      float *(&rows)[kernel_size],
+                                      int32_t height,
+                                      int32_t width,
+                                      int32_t channels) -> void
+{
+  int32_t constexpr padding = kernel_size / 2;
+
+  int32_t padded_channels = (channels + 3) / 4 * 4;
+  int32_t row_size = (width + 2 * padding) * padded_channels;
+
+  // row_buffer is a ring of kernel_size padded rows; at input row h, rows[kh] is row h + kh - padding.
+  for (int32_t kh = 0; kh < kernel_size; ++kh)
+  {
+    rows[kh] = row_buffer + kh * row_size;
+    depthwise_convolution_load_row<padding, dilation>(x, rows[kh], kh - padding, height, width, channels);
+  }
+}
+
+template <int32_t kernel_size, typename T>
+auto depthwise_convolution_rotate_rows(T *(&rows)[kernel_size]) -> T *
+{
+  // Returns the slot of the oldest row, which now holds row h + kernel_size - 1 - padding of the next h.
+  T *oldest = rows[0];
+  for (int32_t kh = 0; kh < kernel_size - 1; ++kh)
+  {
+    rows[kh] = rows[kh + 1];
+  }
+  rows[kernel_size - 1] = oldest;
+  return oldest;
+}
+
+template <int32_t kernel_size, int32_t dilation, typename T>
+auto depthwise_convolution_advance_rows(T const *__restrict__ x,
+                                        float *(&rows)[kernel_size],
+                                        int32_t h,
+                                        int32_t height,
+                                        int32_t width,
+                                        int32_t channels) -> void
+{
+  int32_t constexpr padding = kernel_size / 2;
+
+  float *oldest = depthwise_convolution_rotate_rows(rows);
+  depthwise_convolution_load_row<padding, dilation>(x, oldest, h + kernel_size - 1 - padding, height, width, channels);
+}
+
+template <bool flipped, int32_t kernel_size>
+auto depthwise_convolution_load_taps(float const *__restrict__ k,
+                                     v128_t (&taps)[kernel_size][kernel_size],
+                                     int32_t channels,
+                                     int32_t lanes) -> void
+{
+  for (int32_t kh = 0; kh < kernel_size; ++kh)
+  {
+    for (int32_t kw = 0; kw < kernel_size; ++kw)
+    {
+      int32_t k_h = flipped ? kernel_size - 1 - kh : kh;
+      int32_t k_w = flipped ? kernel_size - 1 - kw : kw;
+      taps[kh][kw] = load_lanes(k + k_h * kernel_size * channels + k_w * channels, lanes);
+    }
+  }
+}
+
+template <int32_t tile_w, int32_t stride, bool accumulate, bool statistics, int32_t kernel_size>
+auto depthwise_convolution_forward_tile(float const *__restrict__ const *__restrict__ rows,
+                                        float *__restrict__ y,
+                                        v128_t const (&taps)[kernel_size][kernel_size],
+                                        v128_t &sum,
+                                        v128_t &sum_of_squares,
+                                        v128_t &offset,
+                                        bool &set_offset,
+                                        int32_t padded_channels,
+                                        int32_t channels,
+                                        int32_t lanes) -> void
+{
+  int32_t constexpr columns = (tile_w - 1) * stride + kernel_size;
+
+  // Each padded input column is loaded once per row and reused by every output of the tile it overlaps.
+  v128_t acc[tile_w];
+  for (int32_t t = 0; t < tile_w; ++t)
+  {
+    acc[t] = accumulate ? load_lanes(y + t * channels, lanes) : wasm_f32x4_splat(0.0f);
+  }
+
+  for (int32_t kh = 0; kh < kernel_size; ++kh)
+  {
+    v128_t in[columns];
+    for (int32_t j = 0; j < columns; ++j)
+    {
+      in[j] = wasm_v128_load(rows[kh] + j * padded_channels);
+    }
+    for (int32_t kw = 0; kw < kernel_size; ++kw)
+    {
+      for (int32_t t = 0; t < tile_w; ++t)
+      {
+        acc[t] = wasm_f32x4_add(acc[t], wasm_f32x4_mul(in[t * stride + kw], taps[kh][kw]));
+      }
+    }
+  }
+
+  if constexpr (statistics)
+  {
+    if (set_offset)
+    {
+      offset = acc[0];
+      set_offset = false;
+    }
+  }
+
+  for (int32_t t = 0; t < tile_w; ++t)
+  {
+    store_lanes(y + t * channels, acc[t], lanes);
+    if constexpr (statistics)
+    {
+      v128_t d = wasm_f32x4_sub(acc[t], offset);
+      sum = wasm_f32x4_add(sum, d);
+      sum_of_squares = wasm_f32x4_add(sum_of_squares, wasm_f32x4_mul(d, d));
+    }
+  }
+}
+
+template <int32_t stride, bool accumulate, bool statistics, int32_t kernel_size>
+auto depthwise_convolution_forward_row(float const *__restrict__ const *__restrict__ rows,
+                                       float *__restrict__ y,
+                                       float const *y_first,
+                                       v128_t const (&taps)[kernel_size][kernel_size],
+                                       float *__restrict__ sum,
+                                       float *__restrict__ sum_of_squares,
+                                       int32_t y_w,
+                                       int32_t padded_channels,
+                                       int32_t channels,
+                                       int32_t lanes) -> void
+{
+  int32_t constexpr tile_w = 4;
+
+  // Statistics of the row are gathered in registers and added to the per-channel totals once per row,
+  // which also keeps the float sums from growing too far ahead of the values being added. They are taken
+  // relative to the first output pixel y_first, as in instance_normalization_forward, which the first row
+  // produces before it needs it.
+  v128_t row_sum = wasm_f32x4_splat(0.0f);
+  v128_t row_sum_of_squares = wasm_f32x4_splat(0.0f);
+  bool set_offset = statistics && y == y_first;
+  v128_t offset = statistics && !set_offset ? load_lanes(y_first, lanes) : wasm_f32x4_splat(0.0f);
+
+  float const *rows_w[kernel_size];
+  for (int32_t kh = 0; kh < kernel_size; ++kh)
+  {
+    rows_w[kh] = rows[kh];
+  }
+
+  int32_t w = 0;
+  for (; w + tile_w <= y_w; w += tile_w)
+  {
+    depthwise_convolution_forward_tile<tile_w, stride, accumulate, statistics>(rows_w,
+                                                                              y + w * channels,
+                                                                              taps,
+                                                                              row_sum,
+                                                                              row_sum_of_squares,
+                                                                              offset,
+                                                                              set_offset,
+                                                                              padded_channels,
+                                                                              channels,
+                                                                              lanes);
+    for (int32_t kh = 0; kh < kernel_size; ++kh)
+    {
+      rows_w[kh] += tile_w * stride * padded_channels;
+    }
+  }
+  for (; w < y_w; ++w)
+  {
+    depthwise_convolution_forward_tile<1, stride, accumulate, statistics>(rows_w,
+                                                                         y + w * channels,
+                                                                         taps,
+                                                                         row_sum,
+                                                                         row_sum_of_squares,
+                                                                         offset,
+                                                                         set_offset,
+                                                                         padded_channels,
+                                                                         channels,
+                                                                         lanes);
+    for (int32_t kh = 0; kh < kernel_size; ++kh)
+    {
+      rows_w[kh] += stride * padded_channels;
+    }
+  }
+
+  if constexpr (statistics)
+  {
+    store_lanes(sum, wasm_f32x4_add(load_lanes(sum, lanes), row_sum), lanes);
+    store_lanes(sum_of_squares, wasm_f32x4_add(load_lanes(sum_of_squares, lanes), row_sum_of_squares), lanes);
+  }
+}
+
+template <int32_t fixed_channels, int32_t kernel_size, int32_t stride>
+auto depthwise_convolution_forward_output_row(float const *__restrict__ const *__restrict__ rows,
+                                              float *__restrict__ y,
+                                              float const *y_first,
+                                              float const *__restrict__ k,
+                                              float *__restrict__ sum,
+                                              float *__restrict__ sum_of_squares,
+                                              int32_t y_w,
+                                              int32_t channels) -> void
+{
+  channels = channel_count<fixed_channels>(channels);
+
+  int32_t padded_channels = (channels + 3) / 4 * 4;
+
+  for (int32_t c = 0; c < channels; c += 4)
+  {
+    int32_t lanes = min(4, channels - c);
+
+    v128_t taps[kernel_size][kernel_size];
+    depthwise_convolution_load_taps<false>(k + c, taps, channels, lanes);
+
+    float const *rows_c[kernel_size];
+    for (int32_t kh = 0; kh < kernel_size; ++kh)
+    {
+      rows_c[kh] = rows[kh] + c;
+    }
+
+    if (sum != nullptr)
+    {
+      depthwise_convolution_forward_row<stride, false, true>(rows_c,
+                                                             y + c,
+                                                             y_first + c,
+                                                             taps,
+                                                             sum + c,
+                                                             sum_of_squares + c,
+                                                             y_w,
+                                                             padded_channels,
+                                                             channels,
+                                                             lanes);
+    }
+    else
+    {
+      depthwise_convolution_forward_row<stride, false, false>(rows_c,
+                                                              y + c,
+                                                              nullptr,
+                                                              taps,
+                                                              nullptr,
+                                                              nullptr,
+                                                              y_w,
+                                                              padded_channels,
+                                                              channels,
+                                                              lanes);
+    }
+  }
+}
+
+template <int32_t fixed_channels, int32_t kernel_size, int32_t stride, typename T>
+auto depthwise_convolution_forward_inner(T const *__restrict__ x,
+                                         float *__restrict__ y,
+                                         float const *__restrict__ k,
+                                         [[maybe_unused]] float const *__restrict__ b,
+                                         float *__restrict__ row_buffer,
+                                         float *__restrict__ sum,
+                                         float *__restrict__ sum_of_squares,
+                                         int32_t height,
+                                         int32_t width,
+                                         int32_t channels) -> void
+{
+  channels = channel_count<fixed_channels>(channels);
+
+  int32_t y_w = (width + stride - 1) / stride;
+
+  // When sum and sum_of_squares are given, the per-channel statistics of y, relative to its first pixel, are
+  // produced along the way so a following instance normalization can skip its statistics pass.
+  if (sum != nullptr)
+  {
+    for (int32_t c = 0; c < channels; ++c)
+    {
+      sum[c] = 0.0f;
+      sum_of_squares[c] = 0.0f;
+    }
+  }
+
+  float *rows[kernel_size];
+  depthwise_convolution_start_rows<kernel_size, 1>(x, row_buffer, rows, height, width, channels);
+
+  for (int32_t h = 0; h < height; ++h)
+  {
+    if (h > 0)
+    {
+      depthwise_convolution_advance_rows<kernel_size, 1>(x, rows, h, height, width, channels);
+    }
+    if (h % stride != 0)
+    {
+      continue;
+    }
+
+    depthwise_convolution_forward_output_row<fixed_channels, kernel_size, stride>(rows,
+                                                                                  y + (h / stride) * y_w * channels,
+                                                                                  y,
+                                                                                  k,
+                                                                                  sum,
+                                                                                  sum_of_squares,
+                                                                                  y_w,
+                                                                                  channels);
+  }
+}
+
+template <int32_t kernel_size, int32_t stride, typename T>
+auto depthwise_convolution_forward_blocked_inner(T const *__restrict__ x,
+                                                 float *__restrict__ y,
+                                                 float const *__restrict__ k,
+                                                 [[maybe_unused]] float const *__restrict__ b,
+                                                 float *__restrict__ row_buffer,
+                                                 float *__restrict__ sum,
+                                                 float *__restrict__ sum_of_squares,
+                                                 int32_t height,
+                                                 int32_t width,
+                                                 int32_t channels) -> void
+{
+  int32_t y_h = (height + stride - 1) / stride;
+  int32_t y_w = (width + stride - 1) / stride;
+
+  // Every block of 4 channels is a height x width x 4 plane of its own, so the ring only ever holds one block and
+  // its rows need no channel padding.
+  for (int32_t c = 0; c < channels; c += 4)
+  {
+    int32_t lanes = min(4, channels - c);
+
+    T const *x_c = x + c * height * width;
+    float *y_c = y + c * y_h * y_w;
+
+    v128_t taps[kernel_size][kernel_size];
+    depthwise_convolution_load_taps<false>(k + c, taps, channels, lanes);
+
+    if (sum != nullptr)
+    {
+      store_lanes(sum + c, wasm_f32x4_splat(0.0f), lanes);
+      store_lanes(sum_of_squares + c, wasm_f32x4_splat(0.0f), lanes);
+    }
+
+    float *rows[kernel_size];
+    depthwise_convolution_start_rows<kernel_size, 1>(x_c, row_buffer, rows, height, width, 4);
+
+    for (int32_t h = 0; h < height; ++h)
+    {
+      if (h > 0)
+      {
+        depthwise_convolution_advance_rows<kernel_size, 1>(x_c, rows, h, height, width, 4);
+      }
+      if (h % stride != 0)
+      {
+        continue;
+      }
+
+      if (sum != nullptr)
+      {
+        depthwise_convolution_forward_row<stride, false, true>(rows,
+                                                               y_c + (h / stride) * y_w * 4,
+                                                               y_c,
+                                                               taps,
+                                                               sum + c,
+                                                               sum_of_squares + c,
+                                                               y_w,
+                                                               4,
+                                                               4,
+                                                               lanes);
+      }
+      else
+      {
+        depthwise_convolution_forward_row<stride, false, false>(rows,
+                                                                y_c + (h / stride) * y_w * 4,
+                                                                nullptr,
+                                                                taps,
+                                                                nullptr,
+                                                                nullptr,
+                                                                y_w,
+                                                                4,
+                                                                4,
+                                                                lanes);
+      }
+    }
+  }
+}
+
+template <int32_t kernel_size, int32_t stride, typename T>
+auto depthwise_convolution_forward_shape(T const *__restrict__ x,
+                                         float *__restrict__ y,
+                                         float const *__restrict__ k,
+                                         float const *__restrict__ b,
+                                         float *__restrict__ row_buffer,
+                                         float *__restrict__ sum,
+                                         float *__restrict__ sum_of_squares,
+                                         int32_t height,
+                                         int32_t width,
+                                         int32_t channels,
+                                         int32_t blocked) -> void
+{
+  if (blocked)
+  {
+    depthwise_convolution_forward_blocked_inner<kernel_size, stride>(x,
+                                                                     y,
+                                                                     k,
+                                                                     b,
+                                                                     row_buffer,
+                                                                     sum,
+                                                                     sum_of_squares,
+                                                                     height,
+                                                                     width,
+                                                                     channels);
+    return;
+  }
+
+  static constexpr auto table = make_channel_table([]<int32_t fixed_channels>()
+                                                   { return &depthwise_convolution_forward_inner<fixed_channels, kernel_size, stride, T>; });
+  table[channels](x,
+                  y,
+                  k,
+                  b,
+                  row_buffer,
+                  sum,
+                  sum_of_squares,
+                  height,
+                  width,
+                  channels);
+}
+
+template <typename T>
+auto depthwise_convolution_forward_dispatch(T const *__restrict__ x,
+                                            float *__restrict__ y,
+                                            float const *__restrict__ k,
+                                            float const *__restrict__ b,
+                                            float *__restrict__ row_buffer,
+                                            float *__restrict__ sum,
+                                            float *__restrict__ sum_of_squares,
+                                            int32_t height,
+                                            int32_t width,
+                                            int32_t channels,
+                                            int32_t kernel_size,
+                                            int32_t stride,
+                                            int32_t blocked) -> void
+{
+  if (kernel_size == 3 && stride == 1)
+  {
+    depthwise_convolution_forward_shape<3, 1>(x, y, k, b, row_buffer, sum, sum_of_squares, height, width, channels, blocked);
+  }
+  else if (kernel_size == 3 && stride == 2)
+  {
+    depthwise_convolution_forward_shape<3, 2>(x, y, k, b, row_buffer, sum, sum_of_squares, height, width, channels, blocked);
+  }
+  else if (kernel_size == 5 && stride == 1)
+  {
+    depthwise_convolution_forward_shape<5, 1>(x, y, k, b, row_buffer, sum, sum_of_squares, height, width, channels, blocked);
+  }
+  else if (kernel_size == 5 && stride == 2)
+  {
+    depthwise_convolution_forward_shape<5, 2>(x, y, k, b, row_buffer, sum, sum_of_squares, height, width, channels, blocked);
+  }
+  else if (kernel_size == 7 && stride == 1)
+  {
+    depthwise_convolution_forward_shape<7, 1>(x, y, k, b, row_buffer, sum, sum_of_squares, height, width, channels, blocked);
+  }
+  else if (kernel_size == 7 && stride == 2)
+  {
+    depthwise_convolution_forward_shape<7, 2>(x, y, k, b, row_buffer, sum, sum_of_squares, height, width, channels, blocked);
+  }
+}
+
+auto depthwise_convolution_forward(float const *__restrict__ x,
+                                   float *__restrict__ y,
+                                   float const *__restrict__ k,
+                                   float const *__restrict__ b,
+                                   float *__restrict__ row_buffer,
+                                   float *__restrict__ sum,
+                                   float *__restrict__ sum_of_squares,
+                                   int32_t height,
+                                   int32_t width,
+                                   int32_t channels,
+                                   int32_t kernel_size,
+                                   int32_t stride,
+                                   int32_t blocked) -> void
+{
+  depthwise_convolution_forward_dispatch(x, y, k, b, row_buffer, sum, sum_of_squares, height, width, channels, kernel_size, stride, blocked);
+}
+
+// depthwise_convolution_forward with x stored in half precision.
+auto depthwise_convolution_forward_bf16(bfloat16 const *__restrict__ x,
+                                        float *__restrict__ y,
+                                        float const *__restrict__ k,
+                                        float const *__restrict__ b,
+                                        float *__restrict__ row_buffer,
+                                        float *__restrict__ sum,
+                                        float *__restrict__ sum_of_squares,
+                                        int32_t height,
+                                        int32_t width,
+                                        int32_t channels,
+                                        int32_t kernel_size,
+                                        int32_t stride,
+                                        int32_t blocked) -> void
+{
+  depthwise_convolution_forward_dispatch(x, y, k, b, row_buffer, sum, sum_of_squares, height, width, channels, kernel_size, stride, blocked);
+}
+
+template <int32_t tile_w, int32_t stride, int32_t kernel_size>
+auto depthwise_convolution_backward_kernel_tile(float const *__restrict__ const *__restrict__ rows,
+                                                float const *__restrict__ d_y,
+                                                v128_t (&acc)[kernel_size][kernel_size],
+                                                int32_t padded_channels,
+                                                int32_t channels,
+                                                int32_t lanes) -> void
+{
+  int32_t constexpr columns = (tile_w - 1) * stride + kernel_size;
+
+  v128_t d[tile_w];
+  for (int32_t t = 0; t < tile_w; ++t)
+  {
+    d[t] = load_lanes(d_y + t * channels, lanes);
+  }
+
+  for (int32_t kh = 0; kh < kernel_size; ++kh)
+  {
+    v128_t in[columns];
+    for (int32_t j = 0; j < columns; ++j)
+    {
+      in[j] = wasm_v128_load(rows[kh] + j * padded_channels);
+    }
+    for (int32_t kw = 0; kw < kernel_size; ++kw)
+    {
+      for (int32_t t = 0; t < tile_w; ++t)
+      {
+        acc[kh][kw] = wasm_f32x4_add(acc[kh][kw], wasm_f32x4_mul(in[t * stride + kw], d[t]));
+      }
+    }
+  }
+}
+
+template <int32_t stride, int32_t kernel_size>
+auto depthwise_convolution_backward_row(float const *__restrict__ const *__restrict__ rows,
+                                        float const *__restrict__ const *__restrict__ gradient_rows,
+                                        float const *__restrict__ d_y,
+                                        float *__restrict__ d_x,
+                                        float const *__restrict__ k,
+                                        float *__restrict__ d_k,
+                                        int32_t width,
+                                        int32_t padded_channels,
+                                        int32_t channels,
+                                        int32_t kernel_channels,
+                                        int32_t lanes,
+                                        int32_t accumulate) -> void
+{
+  int32_t constexpr tile_w = 4;
+
+  int32_t y_w = (width + stride - 1) / stride;
+
+  v128_t flipped_taps[kernel_size][kernel_size];
+  depthwise_convolution_load_taps<true>(k, flipped_taps, kernel_channels, lanes);
+
+  if (accumulate)
+  {
+    depthwise_convolution_forward_row<1, true, false>(gradient_rows,
+                                                      d_x,
+                                                      nullptr,
+                                                      flipped_taps,
+                                                      nullptr,
+                                                      nullptr,
+                                                      width,
+                                                      padded_channels,
+                                                      channels,
+                                                      lanes);
+  }
+  else
+  {
+    depthwise_convolution_forward_row<1, false, false>(gradient_rows,
+                                                       d_x,
+                                                       nullptr,
+                                                       flipped_taps,
+                                                       nullptr,
+                                                       nullptr,
+                                                       width,
+                                                       padded_channels,
+                                                       channels,
+                                                       lanes);
+  }
+
+  // Rows of x that no output starts on only contribute to d_x.
+  if (d_y == nullptr)
+  {
+    return;
+  }
+
+  v128_t acc[kernel_size][kernel_size];
+  for (int32_t kh = 0; kh < kernel_size; ++kh)
+  {
+    for (int32_t kw = 0; kw < kernel_size; ++kw)
+    {
+      acc[kh][kw] = wasm_f32x4_splat(0.0f);
+    }
+  }
+
+  float const *rows_w[kernel_size];
+  for (int32_t kh = 0; kh < kernel_size; ++kh)
+  {
+    rows_w[kh] = rows[kh];
+  }
+
+  int32_t w = 0;
+  for (; w + tile_w <= y_w; w += tile_w)
+  {
+    depthwise_convolution_backward_kernel_tile<tile_w, stride>(rows_w,
+                                                               d_y + w * channels,
+                                                               acc,
+                                                               padded_channels,
+                                                               channels,
+                                                               lanes);
+    for (int32_t kh = 0; kh < kernel_size; ++kh)
+    {
+      rows_w[kh] += tile_w * stride * padded_channels;
+    }
+  }
+  for (; w < y_w; ++w)
+  {
+    depthwise_convolution_backward_kernel_tile<1, stride>(rows_w,
+                                                          d_y + w * channels,
+                                                          acc,
+                                                          padded_channels,
+                                                          channels,
+                                                          lanes);
+    for (int32_t kh = 0; kh < kernel_size; ++kh)
+    {
+      rows_w[kh] += stride * padded_channels;
+    }
+  }
+
+  for (int32_t kh = 0; kh < kernel_size; ++kh)
+  {
+    for (int32_t kw = 0; kw < kernel_size; ++kw)
+    {
+      float *d_k_i = d_k + kh * kernel_size * kernel_channels + kw * kernel_channels;
+      store_lanes(d_k_i, wasm_f32x4_add(load_lanes(d_k_i, lanes), acc[kh][kw]), lanes);
+    }
+  }
+}
+
+template <int32_t fixed_channels, int32_t kernel_size, int32_t stride, typename T>
+auto depthwise_convolution_backward_inner(float const *__restrict__ d_y,
+                                          float *__restrict__ d_x,
+                                          float *__restrict__ d_k,
+                                          [[maybe_unused]] float *__restrict__ d_b,
+                                          float const *__restrict__ k,
+                                          T const *__restrict__ x,
+                                          float *__restrict__ row_buffer,
+                                          float *__restrict__ gradient_row_buffer,
+                                          int32_t height,
+                                          int32_t width,
+                                          int32_t channels,
+                                          int32_t accumulate) -> void
+{
+  channels = channel_count<fixed_channels>(channels);
+
+  int32_t y_w = (width + stride - 1) / stride;
+
+  int32_t padded_channels = (channels + 3) / 4 * 4;
+
+  // d_x is gathered as the correlation of the padded (and, for stride 2, zero-dilated) d_y rows with the flipped
+  // kernel, so every element of d_x is written once. d_k is accumulated over a whole output row in local partials
+  // and added to memory once per row.
+  float *rows[kernel_size];
+  float *gradient_rows[kernel_size];
+  depthwise_convolution_start_rows<kernel_size, 1>(x, row_buffer, rows, height, width, channels);
+  depthwise_convolution_start_rows<kernel_size, stride>(d_y, gradient_row_buffer, gradient_rows, height, width, channels);
+
+  for (int32_t h = 0; h < height; ++h)
+  {
+    if (h > 0)
+    {
+      depthwise_convolution_advance_rows<kernel_size, 1>(x, rows, h, height, width, channels);
+      depthwise_convolution_advance_rows<kernel_size, stride>(d_y, gradient_rows, h, height, width, channels);
+    }
+
+    for (int32_t c = 0; c < channels; c += 4)
+    {
+      float const *rows_c[kernel_size];
+      float const *gradient_rows_c[kernel_size];
+      for (int32_t kh = 0; kh < kernel_size; ++kh)
+      {
+        rows_c[kh] = rows[kh] + c;
+        gradient_rows_c[kh] = gradient_rows[kh] + c;
+      }
+
+      depthwise_convolution_backward_row<stride, kernel_size>(rows_c,
+                                                              gradient_rows_c,
+                                                              h % stride == 0 ? d_y + (h / stride) * y_w * channels + c : nullptr,
+                                                              d_x + h * width * channels + c,
+                                                              k + c,
+                                                              d_k + c,
+                                                              width,
+                                                              padded_channels,
+                                                              channels,
+                                                              channels,
+                                                              min(4, channels - c),
+                                                              accumulate);
+    }
+  }
+}
+
+template <int32_t kernel_size, int32_t stride, typename T>
+auto depthwise_convolution_backward_blocked_inner(float const *__restrict__ d_y,
+                                                  float *__restrict__ d_x,
+                                                  float *__restrict__ d_k,
+                                                  [[maybe_unused]] float *__restrict__ d_b,
+                                                  float const *__restrict__ k,
+                                                  T const *__restrict__ x,
+                                                  float *__restrict__ row_buffer,
+                                                  float *__restrict__ gradient_row_buffer,
+                                                  int32_t height,
+                                                  int32_t width,
+                                                  int32_t channels,
+                                                  int32_t accumulate) -> void
+{
+  int32_t y_h = (height + stride - 1) / stride;
+  int32_t y_w = (width + stride - 1) / stride;
+
+  // As in the forward pass, each block of 4 channels runs through both rings as a 4-channel plane.
+  for (int32_t c = 0; c < channels; c += 4)
+  {
+    T const *x_c = x + c * height * width;
+    float const *d_y_c = d_y + c * y_h * y_w;
+    float *d_x_c = d_x + c * height * width;
+
+    float *rows[kernel_size];
+    float *gradient_rows[kernel_size];
+    depthwise_convolution_start_rows<kernel_size, 1>(x_c, row_buffer, rows, height, width, 4);
+    depthwise_convolution_start_rows<kernel_size, stride>(d_y_c, gradient_row_buffer, gradient_rows, height, width, 4);
+
+    for (int32_t h = 0; h < height; ++h)
+    {
+      if (h > 0)
+      {
+        depthwise_convolution_advance_rows<kernel_size, 1>(x_c, rows, h, height, width, 4);
+        depthwise_convolution_advance_rows<kernel_size, stride>(d_y_c, gradient_rows, h, height, width, 4);
+      }
+
+      depthwise_convolution_backward_row<stride, kernel_size>(rows,
+                                                              gradient_rows,
+                                                              h % stride == 0 ? d_y_c + (h / stride) * y_w * 4 : nullptr,
+                                                              d_x_c + h * width * 4,
+                                                              k + c,
+                                                              d_k + c,
+                                                              width,
+                                                              4,
+                                                              4,
+                                                              channels,
+                                                              min(4, channels - c),
+                                                              accumulate);
+    }
+  }
+}
+
+template <int32_t kernel_size, int32_t stride, typename T>
+auto depthwise_convolution_backward_shape(float const *__restrict__ d_y,
+                                          float *__restrict__ d_x,
+                                          float *__restrict__ d_k,
+                                          float *__restrict__ d_b,
+                                          float const *__restrict__ k,
+                                          T const *__restrict__ x,
+                                          float *__restrict__ row_buffer,
+                                          float *__restrict__ gradient_row_buffer,
+                                          int32_t height,
+                                          int32_t width,
+                                          int32_t channels,
+                                          int32_t blocked,
+                                          int32_t accumulate) -> void
+{
+  if (blocked)
+  {
+    depthwise_convolution_backward_blocked_inner<kernel_size, stride>(d_y,
+                                                                      d_x,
+                                                                      d_k,
+                                                                      d_b,
+                                                                      k,
+                                                                      x,
+                                                                      row_buffer,
+                                                                      gradient_row_buffer,
+                                                                      height,
+                                                                      width,
+                                                                      channels,
+                                                                      accumulate);
+    return;
+  }
+
+  static constexpr auto table = make_channel_table([]<int32_t fixed_channels>()
+                                                   { return &depthwise_convolution_backward_inner<fixed_channels, kernel_size, stride, T>; });
+  table[channels](d_y,
+                  d_x,
+                  d_k,
+                  d_b,
+                  k,
+                  x,
+                  row_buffer,
+                  gradient_row_buffer,
+                  height,
+                  width,
+                  channels,
+                  accumulate);
+}
+
+template <typename T>
+auto depthwise_convolution_backward_dispatch(float const *__restrict__ d_y,
+                                             float *__restrict__ d_x,
+                                             float *__restrict__ d_k,
+                                             float *__restrict__ d_b,
+                                             float const *__restrict__ k,
+                                             T const *__restrict__ x,
+                                             float *__restrict__ row_buffer,
+                                             float *__restrict__ gradient_row_buffer,
+                                             int32_t height,
+                                             int32_t width,
+                                             int32_t channels,
+                                             int32_t kernel_size,
+                                             int32_t stride,
+                                             int32_t blocked,
+                                             int32_t accumulate) -> void
+{
+  if (kernel_size == 3 && stride == 1)
+  {
+    depthwise_convolution_backward_shape<3, 1>(d_y, d_x, d_k, d_b, k, x, row_buffer, gradient_row_buffer, height, width, channels, blocked, accumulate);
+  }
+  else if (kernel_size == 3 && stride == 2)
+  {
+    depthwise_convolution_backward_shape<3, 2>(d_y, d_x, d_k, d_b, k, x, row_buffer, gradient_row_buffer, height, width, channels, blocked, accumulate);
+  }
+  else if (kernel_size == 5 && stride == 1)
+  {
+    depthwise_convolution_backward_shape<5, 1>(d_y, d_x, d_k, d_b, k, x, row_buffer, gradient_row_buffer, height, width, channels, blocked, accumulate);
+  }
+  else if (kernel_size == 5 && stride == 2)
+  {
+    depthwise_convolution_backward_shape<5, 2>(d_y, d_x, d_k, d_b, k, x, row_buffer, gradient_row_buffer, height, width, channels, blocked, accumulate);
+  }
+  else if (kernel_size == 7 && stride == 1)
+  {
+    depthwise_convolution_backward_shape<7, 1>(d_y, d_x, d_k, d_b, k, x, row_buffer, gradient_row_buffer, height, width, channels, blocked, accumulate);
+  }
+  else if (kernel_size == 7 && stride == 2)
+  {
+    depthwise_convolution_backward_shape<7, 2>(d_y, d_x, d_k, d_b, k, x, row_buffer, gradient_row_buffer, height, width, channels, blocked, accumulate);
+  }
+}
+
+auto depthwise_convolution_backward(float const *__restrict__ d_y,
+                                    float *__restrict__ d_x,
+                                    float *__restrict__ d_k,
+                                    float *__restrict__ d_b,
+                                    float const *__restrict__ k,
+                                    float const *__restrict__ x,
+                                    float *__restrict__ row_buffer,
+                                    float *__restrict__ gradient_row_buffer,
+                                    int32_t height,
+                                    int32_t width,
+                                    int32_t channels,
+                                    int32_t kernel_size,
+                                    int32_t stride,
+                                    int32_t blocked,
+                                    int32_t accumulate) -> void
+{
+  depthwise_convolution_backward_dispatch(d_y, d_x, d_k, d_b, k, x, row_buffer, gradient_row_buffer, height, width, channels, kernel_size, stride, blocked, accumulate);
+}
+
+// depthwise_convolution_backward with x stored in half precision.
+auto depthwise_convolution_backward_bf16(float const *__restrict__ d_y,
+                                         float *__restrict__ d_x,
+                                         float *__restrict__ d_k,
+                                         float *__restrict__ d_b,
+                                         float const *__restrict__ k,
+                                         bfloat16 const *__restrict__ x,
+                                         float *__restrict__ row_buffer,
+                                         float *__restrict__ gradient_row_buffer,
+                                         int32_t height,
+                                         int32_t width,
+                                         int32_t channels,
+                                         int32_t kernel_size,
+                                         int32_t stride,
+                                         int32_t blocked,
+                                         int32_t accumulate) -> void
+{
+  depthwise_convolution_backward_dispatch(d_y, d_x, d_k, d_b, k, x, row_buffer, gradient_row_buffer, height, width, channels, kernel_size, stride, blocked, accumulate);
+}
+
+template <int32_t fixed_channels_expanded, int32_t padding>
+auto inverted_residual_block_expand_row(float const *__restrict__ x,
+                                        float *__restrict__ row,
+                                        float *__restrict__ expanded_row,
+                                        float const *__restrict__ expansion_packed_kernel,
+                                        float const *__restrict__ expansion_bias,
+                                        int32_t h,
+                                        int32_t height,
+                                        int32_t width,
+                                        int32_t channels,
+                                        int32_t channels_expanded) -> void
+{
+  if (h < 0 || h >= height)
+  {
+    depthwise_convolution_load_row<padding, 1>(expanded_row, row, -1, 1, width, channels_expanded);
+    return;
+  }
+
+  pointwise_convolution_forward_inner<fixed_channels_expanded, true>(x + h * width * channels,
+                                                                     expanded_row,
+                                                                     nullptr,
+                                                                     expansion_packed_kernel,
+                                                                     expansion_bias,
+                                                                     1,
+                                                                     width,
+                                                                     channels,
+                                                                     channels_expanded,
+                                                                     0,
+                                                                     0);
+  depthwise_convolution_load_row<padding, 1>(expanded_row, row, 0, 1, width, channels_expanded);
+}
+
+template <int32_t fixed_channels_expanded, int32_t kernel_size>
+auto inverted_residual_block_forward_inner(float const *__restrict__ x,
+                                           float *__restrict__ y,
+                                           float const *__restrict__ expansion_packed_kernel,
+                                           float const *__restrict__ expansion_bias,
+                                           float const *__restrict__ depthwise_kernel,
+                                           float const *__restrict__ gamma,
+                                           float const *__restrict__ beta,
+                                           float const *__restrict__ reduction_kernel,
+                                           float const *__restrict__ reduction_bias,
+                                           float *__restrict__ depthwise_y,
+                                           float *__restrict__ row_buffer,
+                                           float *__restrict__ scratch,
+                                           float epsilon,
+                                           int32_t height,
+                                           int32_t width,
+                                           int32_t channels,
+                                           int32_t channels_expanded) -> void
+{
+  channels_expanded = channel_count<fixed_channels_expanded>(channels_expanded);
+
+  int32_t constexpr padding = kernel_size / 2;
+  int32_t constexpr tile_m = 4;
+
+  int32_t padded_channels = (channels_expanded + 3) / 4 * 4;
+  int32_t row_size = (width + 2 * padding) * padded_channels;
+
+  float *expanded_row = scratch;
+  float *sum = expanded_row + width * channels_expanded;
+  float *sum_of_squares = sum + channels_expanded;
+  float *folded_bias = sum_of_squares + channels_expanded;
+  float *folded_packed_kernel = folded_bias + channels;
+
+  for (int32_t c = 0; c < channels_expanded; ++c)
+  {
+    sum[c] = 0.0f;
+    sum_of_squares[c] = 0.0f;
+  }
+
+  // First phase: the expansion output only ever exists as the kernel_size rows of the depthwise ring, each
+  // computed once when the ring first needs it, and the depthwise output is written with its statistics.
+  float *rows[kernel_size];
+  for (int32_t kh = 0; kh < kernel_size; ++kh)
+  {
+    rows[kh] = row_buffer + kh * row_size;
+    inverted_residual_block_expand_row<fixed_channels_expanded, padding>(x,
+                                                                         rows[kh],
+                                                                         expanded_row,
+                                                                         expansion_packed_kernel,
+                                                                         expansion_bias,
+                                                                         kh - padding,
+                                                                         height,
+                                                                         width,
+                                                                         channels,
+                                                                         channels_expanded);
+  }
+
+  for (int32_t h = 0; h < height; ++h)
+  {
+    if (h > 0)
+    {
+      inverted_residual_block_expand_row<fixed_channels_expanded, padding>(x,
+                                                                           depthwise_convolution_rotate_rows(rows),
+                                                                           expanded_row,
+                                                                           expansion_packed_kernel,
+                                                                           expansion_bias,
+                                                                           h + kernel_size - 1 - padding,
+                                                                           height,
+                                                                           width,
+                                                                           channels,
+                                                                           channels_expanded);
+    }
+
+    depthwise_convolution_forward_output_row<fixed_channels_expanded, kernel_size, 1>(rows,
+                                                                                      depthwise_y + h * width * channels_expanded,
+                                                                                      depthwise_y,
+                                                                                      depthwise_kernel,
+                                                                                      sum,
+                                                                                      sum_of_squares,
+                                                                                      width,
+                                                                                      channels_expanded);
+  }
+
+  // Instance normalization is a per-channel affine map once the statistics are known, so it is folded into
+  // the rows of the reduction kernel and its bias, packed as in pack_pointwise_convolution_kernel.
+  float reciprocal_num = 1.0f / (height * width);
+  for (int32_t n = 0; n < channels; ++n)
+  {
+    folded_bias[n] = reduction_bias[n];
+  }
+  for (int32_t i_k = 0; i_k < channels_expanded; ++i_k)
+  {
+    float mean_offset = sum[i_k] * reciprocal_num;
+    float variance = max(sum_of_squares[i_k] * reciprocal_num - mean_offset * mean_offset, 0.0f);
+    float mean = depthwise_y[i_k] + mean_offset;
+    float scale = gamma[i_k] / __builtin_sqrtf(variance + epsilon);
+    float shift = beta[i_k] - mean * scale;
+
+    for (int32_t n = 0; n < channels; ++n)
+    {
+      folded_bias[n] += reduction_kernel[i_k * channels + n] * shift;
+    }
+    for (int32_t i_n = 0; i_n < channels; i_n += 8)
+    {
+      for (int32_t j = 0; j < 8; ++j)
+      {
+        float value = i_n + j < channels ? reduction_kernel[i_k * channels + i_n + j] * scale : 0.0f;
+        folded_packed_kernel[i_n * channels_expanded + i_k * 8 + j] = value;
+      }
+    }
+  }
+
+  // Second phase: the reduction and the residual addition, one tile of pixels at a time while it is in cache.
+  for (int32_t i_m = 0; i_m < height * width; i_m += tile_m)
+  {
+    int32_t rows_m = min(tile_m, height * width - i_m);
+    if (rows_m == tile_m)
+    {
+      pointwise_convolution_forward_rows<tile_m, false>(depthwise_y + i_m * channels_expanded,
+                                                        y + i_m * channels,
+                                                        nullptr,
+                                                        folded_packed_kernel,
+                                                        folded_bias,
+                                                        channels_expanded,
+                                                        channels,
+                                                        nhwc_layout(channels_expanded),
+                                                        nhwc_layout(channels));
+    }
+    else
+    {
+      for (int32_t m = 0; m < rows_m; ++m)
+      {
+        pointwise_convolution_forward_rows<1, false>(depthwise_y + (i_m + m) * channels_expanded,
+                                                     y + (i_m + m) * channels,
+                                                     nullptr,
+                                                     folded_packed_kernel,
+                                                     folded_bias,
+                                                     channels_expanded,
+                                                     channels,
+                                                     nhwc_layout(channels_expanded),
+                                                     nhwc_layout(channels));
+      }
+    }
+
+    for (int32_t i = i_m * channels; i < (i_m + rows_m) * channels; i += 4)
+    {
+      int32_t lanes = min(4, (i_m + rows_m) * channels - i);
+      store_lanes(y + i, wasm_f32x4_add(load_lanes(y + i, lanes), load_lanes(x + i, lanes)), lanes);
+    }
+  }
+}
+
+template <int32_t kernel_size>
+auto inverted_residual_block_forward_shape(float const *__restrict__ x,
+                                           float *__restrict__ y,
+                                           float const *__restrict__ expansion_packed_kernel,
+                                           float const *__restrict__ expansion_bias,
+                                           float const *__restrict__ depthwise_kernel,
+                                           float const *__restrict__ gamma,
+                                           float const *__restrict__ beta,
+                                           float const *__restrict__ reduction_kernel,
+                                           float const *__restrict__ reduction_bias,
+                                           float *__restrict__ depthwise_y,
+                                           float *__restrict__ row_buffer,
+                                           float *__restrict__ scratch,
+                                           float epsilon,
+                                           int32_t height,
+                                           int32_t width,
+                                           int32_t channels,
+                                           int32_t channels_expanded) -> void
+{
+  static constexpr auto table = make_channel_table([]<int32_t fixed_channels_expanded>()
+                                                   { return &inverted_residual_block_forward_inner<fixed_channels_expanded, kernel_size>; });
+  table[channels_expanded](x,
+                           y,
+                           expansion_packed_kernel,
+                           expansion_bias,
+                           depthwise_kernel,
+                           gamma,
+                           beta,
+                           reduction_kernel,
+                           reduction_bias,
+                           depthwise_y,
+                           row_buffer,
+                           scratch,
+                           epsilon,
+                           height,
+                           width,
+                           channels,
+                           channels_expanded);
+}
+
+// Inference forward of a whole block: pointwise_convolution_hard_swish_forward, depthwise_convolution_forward
+// with a stride of 1, instance_normalization_forward, pointwise_convolution_forward and add_forward with x.
+// row_buffer is the padded row ring of depthwise_convolution_forward. scratch holds
+// width * channels_expanded + 2 * channels_expanded + channels + (channels + 7) / 8 * 8 * channels_expanded
+// values. depthwise_y receives the depthwise output, the only expanded tensor written out in full.
+auto inverted_residual_block_forward(float const *__restrict__ x,
+                                     float *__restrict__ y,
+                                     float const *__restrict__ expansion_packed_kernel,
+                                     float const *__restrict__ expansion_bias,
+                                     float const *__restrict__ depthwise_kernel,
+                                     float const *__restrict__ gamma,
+                                     float const *__restrict__ beta,
+                                     float const *__restrict__ reduction_kernel,
+                                     float const *__restrict__ reduction_bias,
+                                     float *__restrict__ depthwise_y,
+                                     float *__restrict__ row_buffer,
+                                     float *__restrict__ scratch,
+                                     float epsilon,
+                                     int32_t height,
+                                     int32_t width,
+                                     int32_t channels,
+                                     int32_t channels_expanded,
+                                     int32_t kernel_size) -> void
 {
-  if (channels == 2 * 16)
-  {
-    depthwise_convolution_forward_inner<2 * 16>(x, y, k, b, height, width);
-  }
-  else if (channels == 2 * 24)
+  if (kernel_size == 3)
   {
-    depthwise_convolution_forward_inner<2 * 24>(x, y, k, b, height, width);
+    inverted_residual_block_forward_shape<3>(x, y, expansion_packed_kernel, expansion_bias, depthwise_kernel, gamma, beta, reduction_kernel, reduction_bias, depthwise_y, row_buffer, scratch, epsilon, height, width, channels, channels_expanded);
   }
-  else if (channels == 2 * 32)
+  else if (kernel_size == 5)
   {
-    depthwise_convolution_forward_inner<2 * 32>(x, y, k, b, height, width);
+    inverted_residual_block_forward_shape<5>(x, y, expansion_packed_kernel, expansion_bias, depthwise_kernel, gamma, beta, reduction_kernel, reduction_bias, depthwise_y, row_buffer, scratch, epsilon, height, width, channels, channels_expanded);
   }
-  else if (channels == 2 * 40)
+  else if (kernel_size == 7)
   {
-    depthwise_convolution_forward_inner<2 * 40>(x, y, k, b, height, width);
-  }
-  else if (channels == 2 * 48)
-  {
-    depthwise_convolution_forward_inner<2 * 48>(x, y, k, b, height, width);
+    inverted_residual_block_forward_shape<7>(x, y, expansion_packed_kernel, expansion_bias, depthwise_kernel, gamma, beta, reduction_kernel, reduction_bias, depthwise_y, row_buffer, scratch, epsilon, height, width, channels, channels_expanded);
   }
 }
 
-template <int32_t channels>
-auto depthwise_convolution_backward_inner(float const *__restrict__ d_y,
-                                          float *__restrict__ d_x,
-                                          float *__restrict__ d_k,
-                                          [[maybe_unused]] float *__restrict__ d_b,
-                                          float const *__restrict__ k,
-                                          float const *__restrict__ x,
-                                          int32_t height,
-                                          int32_t width) -> void
+auto quantize_depthwise_convolution_kernel(float const *__restrict__ kernel,
+                                           int8_t *__restrict__ packed_kernel,
+                                           float *__restrict__ kernel_scales,
+                                           int32_t channels,
+                                           int32_t kernel_size) -> void
 {
-  int32_t constexpr kernel_height = 5;
-  int32_t constexpr kernel_width = 5;
-
-  int32_t constexpr padding = 2;
-
-  // for (int32_t h = 0; h < height; ++h)
-  // {
-  //   for (int32_t w = 0; w < width; ++w)
-  //   {
-  //     for (int32_t c = 0; c < channels; ++c)
-  //     {
-  //       d_b[c] += d_y[h * width * channels + w * channels + c];
-  //     }
-  //   }
-  // }
-
-  // top left
-  for (int32_t xh = 0; xh < padding; ++xh)
+  // Every channel gets its own symmetric scale, the largest magnitude of its taps over 127.
+  for (int32_t c = 0; c < channels; ++c)
   {
-    for (int32_t kh = padding; kh < kernel_height; ++kh)
+    float magnitude = 0.0f;
+    for (int32_t i = 0; i < kernel_size * kernel_size; ++i)
     {
-      for (int32_t xw = 0; xw < padding; ++xw)
-      {
-        for (int32_t kw = padding; kw < kernel_width; ++kw)
-        {
-          for (int32_t xc = 0; xc < channels; ++xc)
-          {
-            int32_t y_i = xh * width * channels + xw * channels + xc;
-            int32_t x_i = (xh + kh - padding) * width * channels + (xw + kw - padding) * channels + xc;
-            int32_t k_i = kh * kernel_width * channels + kw * channels + xc;
-            d_k[k_i] += x[x_i] * d_y[y_i];
-            d_x[x_i] += k[k_i] * d_y[y_i];
-          }
-        }
-      }
+      magnitude = max(magnitude, __builtin_fabsf(kernel[i * channels + c]));
     }
+    kernel_scales[c] = magnitude / 127.0f;
   }
 
-  // top middle
-  for (int32_t xh = 0; xh < padding; ++xh)
+  // For every block of 4 channels and every kernel row, the taps are taken in pairs of columns: 8 bytes per pair
+  // with the two taps of each channel next to each other, and a zero tap past the last column.
+  int32_t tap_pairs = (kernel_size + 1) / 2;
+  for (int32_t i_c = 0; i_c < channels; i_c += 4)
   {
-    for (int32_t kh = padding; kh < kernel_height; ++kh)
+    for (int32_t kh = 0; kh < kernel_size; ++kh)
     {
-      for (int32_t xw = padding; xw < width - padding; ++xw)
+      for (int32_t p = 0; p < tap_pairs; ++p)
       {
-        for (int32_t kw = 0; kw < kernel_width; ++kw)
+        for (int32_t j = 0; j < 4; ++j)
         {
-          for (int32_t xc = 0; xc < channels; ++xc)
+          for (int32_t i = 0; i < 2; ++i)
           {
-            int32_t y_i = xh * width * channels + xw * channels + xc;
-            int32_t x_i = (xh + kh - padding) * width * channels + (xw + kw - padding) * channels + xc;
-            int32_t k_i = kh * kernel_width * channels + kw * channels + xc;
-            d_k[k_i] += x[x_i] * d_y[y_i];
-            d_x[x_i] += k[k_i] * d_y[y_i];
+            int32_t c = i_c + j;
+            int32_t kw = p * 2 + i;
+            float value = c < channels && kw < kernel_size && kernel_scales[c] > 0.0f ? kernel[(kh * kernel_size + kw) * channels + c] / kernel_scales[c] : 0.0f;
+            packed_kernel[((i_c / 4 * kernel_size + kh) * tap_pairs + p) * 8 + j * 2 + i] = static_cast<int8_t>(__builtin_rintf(value));
           }
         }
       }
     }
   }
+}
 
-  // top right
-  for (int32_t xh = 0; xh < padding; ++xh)
+// Writes one row of the quantized depthwise ring from the int8 row q, which has padding zero columns on the left,
+// padding + 1 on the right and padded_channels channels. The ring row holds, at every padded column w and
+// channel c, the pair (q[w][c], q[w + 1][c]), so a pair of taps of quantize_depthwise_convolution_kernel is a
+// single i32x4.dot_i16x8_s.
+auto quantized_depthwise_convolution_pair_row(int8_t const *__restrict__ q,
+                                              int8_t *__restrict__ row,
+                                              int32_t padded_width,
+                                              int32_t padded_channels) -> void
+{
+  for (int32_t w = 0; w < padded_width; ++w)
   {
-    for (int32_t kh = padding; kh < kernel_height; ++kh)
+    for (int32_t c = 0; c < padded_channels; c += 4)
     {
-      for (int32_t xw = width - padding; xw < width; ++xw)
-      {
-        for (int32_t kw = 0; kw < kernel_width - padding; ++kw)
-        {
-          for (int32_t xc = 0; xc < channels; ++xc)
-          {
-            int32_t y_i = xh * width * channels + xw * channels + xc;
-            int32_t x_i = (xh + kh - padding) * width * channels + (xw + kw - padding) * channels + xc;
-            int32_t k_i = kh * kernel_width * channels + kw * channels + xc;
-            d_k[k_i] += x[x_i] * d_y[y_i];
-            d_x[x_i] += k[k_i] * d_y[y_i];
-          }
-        }
-      }
+      v128_t left = wasm_v128_load32_zero(q + w * padded_channels + c);
+      v128_t right = wasm_v128_load32_zero(q + (w + 1) * padded_channels + c);
+      v128_t pairs = wasm_i8x16_shuffle(left, right, 0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23);
+      wasm_v128_store64_lane(row + (w * padded_channels + c) * 2, pairs, 0);
     }
   }
+}
+
+// One output row of depthwise_convolution_forward with a stride of 1, from the rows of the quantized ring (see
+// quantized_depthwise_convolution_pair_row) and the kernel of quantize_depthwise_convolution_kernel. The output is
+// dequantized with input_scale and the kernel scales, and its statistics relative to the first output pixel y_first
+// are added to sum and sum_of_squares.
+template <int32_t kernel_size>
+auto quantized_depthwise_convolution_forward_row(int8_t const *__restrict__ const *__restrict__ rows,
+                                                 float *__restrict__ y,
+                                                 float const *y_first,
+                                                 int8_t const *__restrict__ packed_kernel,
+                                                 float const *__restrict__ kernel_scales,
+                                                 float *__restrict__ sum,
+                                                 float *__restrict__ sum_of_squares,
+                                                 float input_scale,
+                                                 int32_t width,
+                                                 int32_t channels) -> void
+{
+  int32_t constexpr tap_pairs = (kernel_size + 1) / 2;
 
-  // middle left
-  for (int32_t xh = padding; xh < height - padding; ++xh)
+  int32_t padded_channels = (channels + 3) / 4 * 4;
+
+  for (int32_t c = 0; c < channels; c += 4)
   {
-    for (int32_t kh = 0; kh < kernel_height; ++kh)
+    int32_t lanes = min(4, channels - c);
+
+    v128_t taps[kernel_size][tap_pairs];
+    for (int32_t kh = 0; kh < kernel_size; ++kh)
     {
-      for (int32_t xw = 0; xw < padding; ++xw)
+      for (int32_t p = 0; p < tap_pairs; ++p)
       {
-        for (int32_t kw = padding; kw < kernel_width; ++kw)
-        {
-          for (int32_t xc = 0; xc < channels; ++xc)
-          {
-            int32_t y_i = xh * width * channels + xw * channels + xc;
-            int32_t x_i = (xh + kh - padding) * width * channels + (xw + kw - padding) * channels + xc;
-            int32_t k_i = kh * kernel_width * channels + kw * channels + xc;
-            d_k[k_i] += x[x_i] * d_y[y_i];
-            d_x[x_i] += k[k_i] * d_y[y_i];
-          }
-        }
+        taps[kh][p] = wasm_i16x8_load8x8(packed_kernel + ((c / 4 * kernel_size + kh) * tap_pairs + p) * 8);
       }
     }
-  }
 
-  // middle middle
-  for (int32_t xh = padding; xh < height - padding; ++xh)
-  {
-    for (int32_t kh = 0; kh < kernel_height; ++kh)
+    v128_t scale = wasm_f32x4_mul(load_lanes(kernel_scales + c, lanes), wasm_f32x4_splat(input_scale));
+    v128_t row_sum = wasm_f32x4_splat(0.0f);
+    v128_t row_sum_of_squares = wasm_f32x4_splat(0.0f);
+    bool set_offset = y == y_first;
+    v128_t offset = set_offset ? wasm_f32x4_splat(0.0f) : load_lanes(y_first + c, lanes);
+
+    for (int32_t w = 0; w < width; ++w)
     {
-      for (int32_t xw = padding; xw < width - padding; ++xw)
+      v128_t acc = wasm_i32x4_splat(0);
+      for (int32_t kh = 0; kh < kernel_size; ++kh)
       {
-        for (int32_t kw = 0; kw < kernel_width; ++kw)
+        for (int32_t p = 0; p < tap_pairs; ++p)
         {
-          for (int32_t xc = 0; xc < channels; ++xc)
-          {
-            int32_t y_i = xh * width * channels + xw * channels + xc;
-            int32_t x_i = (xh + kh - padding) * width * channels + (xw + kw - padding) * channels + xc;
-            int32_t k_i = kh * kernel_width * channels + kw * channels + xc;
-            d_k[k_i] += x[x_i] * d_y[y_i];
-            d_x[x_i] += k[k_i] * d_y[y_i];
-          }
+          v128_t in = wasm_i16x8_load8x8(rows[kh] + ((w + p * 2) * padded_channels + c) * 2);
+          acc = wasm_i32x4_add(acc, wasm_i32x4_dot_i16x8(in, taps[kh][p]));
         }
       }
-    }
-  }
 
-  // middle right
-  for (int32_t xh = padding; xh < height - padding; ++xh)
-  {
-    for (int32_t kh = 0; kh < kernel_height; ++kh)
-    {
-      for (int32_t xw = width - padding; xw < width; ++xw)
+      v128_t value = wasm_f32x4_mul(wasm_f32x4_convert_i32x4(acc), scale);
+      store_lanes(y + w * channels + c, value, lanes);
+      if (set_offset)
       {
-        for (int32_t kw = 0; kw < kernel_width - padding; ++kw)
-        {
-          for (int32_t xc = 0; xc < channels; ++xc)
-          {
-            int32_t y_i = xh * width * channels + xw * channels + xc;
-            int32_t x_i = (xh + kh - padding) * width * channels + (xw + kw - padding) * channels + xc;
-            int32_t k_i = kh * kernel_width * channels + kw * channels + xc;
-            d_k[k_i] += x[x_i] * d_y[y_i];
-            d_x[x_i] += k[k_i] * d_y[y_i];
-          }
-        }
+        offset = value;
+        set_offset = false;
       }
+      v128_t d = wasm_f32x4_sub(value, offset);
+      row_sum = wasm_f32x4_add(row_sum, d);
+      row_sum_of_squares = wasm_f32x4_add(row_sum_of_squares, wasm_f32x4_mul(d, d));
     }
+
+    store_lanes(sum + c, wasm_f32x4_add(load_lanes(sum + c, lanes), row_sum), lanes);
+    store_lanes(sum_of_squares + c, wasm_f32x4_add(load_lanes(sum_of_squares + c, lanes), row_sum_of_squares), lanes);
   }
+}
+
+template <int32_t padding>
+auto quantized_inverted_residual_block_expand_row(float const *__restrict__ x,
+                                                  int8_t *__restrict__ row,
+                                                  float *__restrict__ expanded_row,
+                                                  int8_t *__restrict__ q,
+                                                  int8_t const *__restrict__ expansion_packed_kernel,
+                                                  float const *__restrict__ expansion_kernel_scales,
+                                                  float const *__restrict__ expansion_bias,
+                                                  float input_scale,
+                                                  float expanded_scale,
+                                                  int32_t h,
+                                                  int32_t height,
+                                                  int32_t width,
+                                                  int32_t channels,
+                                                  int32_t channels_expanded) -> void
+{
+  int32_t padded_channels = (channels_expanded + 3) / 4 * 4;
+  int32_t padded_width = width + 2 * padding;
 
-  // bottom left
-  for (int32_t xh = height - padding; xh < height; ++xh)
+  if (h < 0 || h >= height)
   {
-    for (int32_t kh = 0; kh < kernel_height - padding; ++kh)
+    for (int32_t i = 0; i < padded_width * padded_channels * 2; ++i)
     {
-      for (int32_t xw = 0; xw < padding; ++xw)
-      {
-        for (int32_t kw = padding; kw < kernel_width; ++kw)
-        {
-          for (int32_t xc = 0; xc < channels; ++xc)
-          {
-            int32_t y_i = xh * width * channels + xw * channels + xc;
-            int32_t x_i = (xh + kh - padding) * width * channels + (xw + kw - padding) * channels + xc;
-            int32_t k_i = kh * kernel_width * channels + kw * channels + xc;
-            d_k[k_i] += x[x_i] * d_y[y_i];
-            d_x[x_i] += k[k_i] * d_y[y_i];
-          }
-        }
-      }
+      row[i] = 0;
     }
+    return;
+  }
+
+  for (int32_t w = 0; w < width; w += 4)
+  {
+    quantized_pointwise_convolution_forward_pixels<true>(x + (h * width + w) * channels,
+                                                         expanded_row + w * channels_expanded,
+                                                         q,
+                                                         expansion_packed_kernel,
+                                                         expansion_kernel_scales,
+                                                         expansion_bias,
+                                                         input_scale,
+                                                         min(4, width - w),
+                                                         channels,
+                                                         channels_expanded);
+  }
+
+  for (int32_t i = 0; i < padding * padded_channels; ++i)
+  {
+    q[i] = 0;
+  }
+  for (int32_t w = 0; w < width; ++w)
+  {
+    quantize_activations(expanded_row + w * channels_expanded,
+                         q + (w + padding) * padded_channels,
+                         channels_expanded,
+                         padded_channels,
+                         1.0f / expanded_scale);
+  }
+  for (int32_t i = (width + padding) * padded_channels; i < (padded_width + 1) * padded_channels; ++i)
+  {
+    q[i] = 0;
+  }
+
+  quantized_depthwise_convolution_pair_row(q, row, padded_width, padded_channels);
+}
+
+template <int32_t kernel_size>
+auto quantized_inverted_residual_block_forward_shape(float const *__restrict__ x,
+                                                     float *__restrict__ y,
+                                                     int8_t const *__restrict__ expansion_packed_kernel,
+                                                     float const *__restrict__ expansion_kernel_scales,
+                                                     float const *__restrict__ expansion_bias,
+                                                     int8_t const *__restrict__ depthwise_packed_kernel,
+                                                     float const *__restrict__ depthwise_kernel_scales,
+                                                     float const *__restrict__ gamma,
+                                                     float const *__restrict__ beta,
+                                                     int8_t const *__restrict__ reduction_packed_kernel,
+                                                     float const *__restrict__ reduction_kernel_scales,
+                                                     float const *__restrict__ reduction_bias,
+                                                     float *__restrict__ depthwise_y,
+                                                     int8_t *__restrict__ row_buffer,
+                                                     float *__restrict__ scratch,
+                                                     float input_scale,
+                                                     float expanded_scale,
+                                                     float normalized_scale,
+                                                     float epsilon,
+                                                     int32_t height,
+                                                     int32_t width,
+                                                     int32_t channels,
+                                                     int32_t channels_expanded) -> void
+{
+  int32_t constexpr padding = kernel_size / 2;
+
+  int32_t padded_channels = (channels_expanded + 3) / 4 * 4;
+  int32_t row_size = (width + 2 * padding) * padded_channels * 2;
+
+  float *expanded_row = scratch;
+  float *sum = expanded_row + max(width, 4) * channels_expanded;
+  float *sum_of_squares = sum + channels_expanded;
+  float *normalization_scale = sum_of_squares + channels_expanded;
+  float *normalization_shift = normalization_scale + channels_expanded;
+  int8_t *q = reinterpret_cast<int8_t *>(normalization_shift + channels_expanded);
+
+  for (int32_t c = 0; c < channels_expanded; ++c)
+  {
+    sum[c] = 0.0f;
+    sum_of_squares[c] = 0.0f;
+  }
+
+  // First phase, as in inverted_residual_block_forward: the int8 expansion output only exists as the rows of the
+  // depthwise ring, and the depthwise output is written in float with its statistics.
+  int8_t *rows[kernel_size];
+  for (int32_t kh = 0; kh < kernel_size; ++kh)
+  {
+    rows[kh] = row_buffer + kh * row_size;
+    quantized_inverted_residual_block_expand_row<padding>(x,
+                                                          rows[kh],
+                                                          expanded_row,
+                                                          q,
+                                                          expansion_packed_kernel,
+                                                          expansion_kernel_scales,
+                                                          expansion_bias,
+                                                          input_scale,
+                                                          expanded_scale,
+                                                          kh - padding,
+                                                          height,
+                                                          width,
+                                                          channels,
+                                                          channels_expanded);
   }
 
-  // bottom middle
-  for (int32_t xh = height - padding; xh < height; ++xh)
+  for (int32_t h = 0; h < height; ++h)
   {
-    for (int32_t kh = 0; kh < kernel_height - padding; ++kh)
+    if (h > 0)
     {
-      for (int32_t xw = padding; xw < width - padding; ++xw)
-      {
-        for (int32_t kw = 0; kw < kernel_width; ++kw)
-        {
-          for (int32_t xc = 0; xc < channels; ++xc)
-          {
-            int32_t y_i = xh * width * channels + xw * channels + xc;
-            int32_t x_i = (xh + kh - padding) * width * channels + (xw + kw - padding) * channels + xc;
-            int32_t k_i = kh * kernel_width * channels + kw * channels + xc;
-            d_k[k_i] += x[x_i] * d_y[y_i];
-            d_x[x_i] += k[k_i] * d_y[y_i];
-          }
-        }
-      }
+      quantized_inverted_residual_block_expand_row<padding>(x,
+                                                            depthwise_convolution_rotate_rows(rows),
+                                                            expanded_row,
+                                                            q,
+                                                            expansion_packed_kernel,
+                                                            expansion_kernel_scales,
+                                                            expansion_bias,
+                                                            input_scale,
+                                                            expanded_scale,
+                                                            h + kernel_size - 1 - padding,
+                                                            height,
+                                                            width,
+                                                            channels,
+                                                            channels_expanded);
     }
+
+    quantized_depthwise_convolution_forward_row<kernel_size>(rows,
+                                                             depthwise_y + h * width * channels_expanded,
+                                                             depthwise_y,
+                                                             depthwise_packed_kernel,
+                                                             depthwise_kernel_scales,
+                                                             sum,
+                                                             sum_of_squares,
+                                                             expanded_scale,
+                                                             width,
+                                                             channels_expanded);
+  }
+
+  float reciprocal_num = 1.0f / (height * width);
+  for (int32_t c = 0; c < channels_expanded; ++c)
+  {
+    float mean_offset = sum[c] * reciprocal_num;
+    float variance = max(sum_of_squares[c] * reciprocal_num - mean_offset * mean_offset, 0.0f);
+    float mean = depthwise_y[c] + mean_offset;
+    normalization_scale[c] = gamma[c] / __builtin_sqrtf(variance + epsilon);
+    normalization_shift[c] = beta[c] - mean * normalization_scale[c];
   }
 
-  // bottom right
-  for (int32_t xh = height - padding; xh < height; ++xh)
+  // Second phase: the activations are requantized after the instance normalization, whose output has a range
+  // that holds across frames, then run through the reduction and added to x a tile of pixels at a time.
+  for (int32_t i_m = 0; i_m < height * width; i_m += 4)
   {
-    for (int32_t kh = 0; kh < kernel_height - padding; ++kh)
+    int32_t rows_m = min(4, height * width - i_m);
+
+    for (int32_t m = 0; m < rows_m; ++m)
     {
-      for (int32_t xw = width - padding; xw < width; ++xw)
+      float const *depthwise_y_m = depthwise_y + (i_m + m) * channels_expanded;
+      for (int32_t c = 0; c < channels_expanded; c += 4)
       {
-        for (int32_t kw = 0; kw < kernel_width - padding; ++kw)
-        {
-          for (int32_t xc = 0; xc < channels; ++xc)
-          {
-            int32_t y_i = xh * width * channels + xw * channels + xc;
-            int32_t x_i = (xh + kh - padding) * width * channels + (xw + kw - padding) * channels + xc;
-            int32_t k_i = kh * kernel_width * channels + kw * channels + xc;
-            d_k[k_i] += x[x_i] * d_y[y_i];
-            d_x[x_i] += k[k_i] * d_y[y_i];
-          }
-        }
+        int32_t lanes = min(4, channels_expanded - c);
+        v128_t value = wasm_f32x4_add(wasm_f32x4_mul(load_lanes(depthwise_y_m + c, lanes), load_lanes(normalization_scale + c, lanes)),
+                                      load_lanes(normalization_shift + c, lanes));
+        store_lanes(expanded_row + m * channels_expanded + c, value, lanes);
       }
     }
+
+    quantized_pointwise_convolution_forward_pixels<false>(expanded_row,
+                                                          y + i_m * channels,
+                                                          q,
+                                                          reduction_packed_kernel,
+                                                          reduction_kernel_scales,
+                                                          reduction_bias,
+                                                          normalized_scale,
+                                                          rows_m,
+                                                          channels_expanded,
+                                                          channels);
+
+    for (int32_t i = i_m * channels; i < (i_m + rows_m) * channels; i += 4)
+    {
+      int32_t lanes = min(4, (i_m + rows_m) * channels - i);
+      store_lanes(y + i, wasm_f32x4_add(load_lanes(y + i, lanes), load_lanes(x + i, lanes)), lanes);
+    }
   }
 }
 
-auto depthwise_convolution_backward(float const *__restrict__ d_y,
-                                    float *__restrict__ d_x,
-                                    float *__restrict__ d_k,
-                                    float *__restrict__ d_b,
-                                    float const *__restrict__ k,
-                                    float const *__restrict__ x,
-                                    int32_t height,
-                                    int32_t width,
-                                    int32_t channels) -> void
+// inverted_residual_block_forward with the kernels of quantize_pointwise_convolution_kernel and
+// quantize_depthwise_convolution_kernel. The activations are quantized with input_scale at the block input,
+// expanded_scale after the expansion and normalized_scale after the instance normalization; everything between
+// stays in float. row_buffer is the ring of the float kernel (kernel_size rows of 2 bytes per padded value are
+// used). scratch holds max(width, 4) * channels_expanded + 4 * channels_expanded values followed by
+// max((width + 2 * (kernel_size / 2) + 1) * ((channels_expanded + 3) / 4 * 4), 4 * ((channels + 1) / 2 * 2),
+// 4 * ((channels_expanded + 1) / 2 * 2)) bytes.
+auto quantized_inverted_residual_block_forward(float const *__restrict__ x,
+                                               float *__restrict__ y,
+                                               int8_t const *__restrict__ expansion_packed_kernel,
+                                               float const *__restrict__ expansion_kernel_scales,
+                                               float const *__restrict__ expansion_bias,
+                                               int8_t const *__restrict__ depthwise_packed_kernel,
+                                               float const *__restrict__ depthwise_kernel_scales,
+                                               float const *__restrict__ gamma,
+                                               float const *__restrict__ beta,
+                                               int8_t const *__restrict__ reduction_packed_kernel,
+                                               float const *__restrict__ reduction_kernel_scales,
+                                               float const *__restrict__ reduction_bias,
+                                               float *__restrict__ depthwise_y,
+                                               int8_t *__restrict__ row_buffer,
+                                               float *__restrict__ scratch,
+                                               float input_scale,
+                                               float expanded_scale,
+                                               float normalized_scale,
+                                               float epsilon,
+                                               int32_t height,
+                                               int32_t width,
+                                               int32_t channels,
+                                               int32_t channels_expanded,
+                                               int32_t kernel_size) -> void
 {
-  if (channels == 2 * 16)
-  {
-    depthwise_convolution_backward_inner<2 * 16>(d_y, d_x, d_k, d_b, k, x, height, width);
-  }
-  else if (channels == 2 * 24)
+  if (kernel_size == 3)
   {
-    depthwise_convolution_backward_inner<2 * 24>(d_y, d_x, d_k, d_b, k, x, height, width);
+    quantized_inverted_residual_block_forward_shape<3>(x, y, expansion_packed_kernel, expansion_kernel_scales, expansion_bias, depthwise_packed_kernel, depthwise_kernel_scales, gamma, beta, reduction_packed_kernel, reduction_kernel_scales, reduction_bias, depthwise_y, row_buffer, scratch, input_scale, expanded_scale, normalized_scale, epsilon, height, width, channels, channels_expanded);
   }
-  else if (channels == 2 * 32)
+  else if (kernel_size == 5)
   {
-    depthwise_convolution_backward_inner<2 * 32>(d_y, d_x, d_k, d_b, k, x, height, width);
+    quantized_inverted_residual_block_forward_shape<5>(x, y, expansion_packed_kernel, expansion_kernel_scales, expansion_bias, depthwise_packed_kernel, depthwise_kernel_scales, gamma, beta, reduction_packed_kernel, reduction_kernel_scales, reduction_bias, depthwise_y, row_buffer, scratch, input_scale, expanded_scale, normalized_scale, epsilon, height, width, channels, channels_expanded);
   }
-  else if (channels == 2 * 40)
+  else if (kernel_size == 7)
   {
-    depthwise_convolution_backward_inner<2 * 40>(d_y, d_x, d_k, d_b, k, x, height, width);
+    quantized_inverted_residual_block_forward_shape<7>(x, y, expansion_packed_kernel, expansion_kernel_scales, expansion_bias, depthwise_packed_kernel, depthwise_kernel_scales, gamma, beta, reduction_packed_kernel, reduction_kernel_scales, reduction_bias, depthwise_y, row_buffer, scratch, input_scale, expanded_scale, normalized_scale, epsilon, height, width, channels, channels_expanded);
   }
-  else if (channels == 2 * 48)
+}
+
+template <typename T>
+auto max_abs_inner(T const *__restrict__ x,
+                   int32_t size) -> float
+{
+  v128_t result = wasm_f32x4_splat(0.0f);
+  for (int32_t i = 0; i < size; i += 4)
   {
-    depthwise_convolution_backward_inner<2 * 48>(d_y, d_x, d_k, d_b, k, x, height, width);
+    result = wasm_f32x4_max(result, wasm_f32x4_abs(load_lanes(x + i, size - i)));
   }
+
+  float values[4];
+  wasm_v128_store(values, result);
+  return max(max(values[0], values[1]), max(values[2], values[3]));
+}
+
+// The largest magnitude in x, which calibrates the activation scales of the quantized kernels.
+auto max_abs(float const *__restrict__ x,
+             int32_t size) -> float
+{
+  return max_abs_inner(x, size);
+}
+
+auto max_abs_bf16(bfloat16 const *__restrict__ x,
+                  int32_t size) -> float
+{
+  return max_abs_inner(x, size);
 }
 
 auto mean_squared_error_forward(float const *__restrict__ x_pred,
                                 float const *__restrict__ x_true,
                                 int32_t size) -> float
 {
-  double result = 0.0;
-  for (int32_t i = 0; i < size; ++i)
-  {
-    result += square(x_pred[i] - x_true[i]);
-  }
-  result /= size;
-  return static_cast<float>(result);
+  return mean_squared_error_forward_backward(x_pred, x_true, nullptr, size, 0.0f, 0);
 }
 
-auto mean_squared_error_backward(float d_y,
-                                 float *__restrict__ d_x,
-                                 float const *__restrict__ x_pred,
-                                 float const *__restrict__ x_true,
-                                 int32_t size) -> void
+// Returns the loss and, unless d_x is null, writes its gradient scaled by d_y in the same pass. With loss_weighted,
+// the gradient is also scaled by the loss, which weights each sample by how far off it is; as the loss is only
+// known at the end, that factor is applied to d_x afterwards, which reads and writes the gradient alone.
+auto mean_squared_error_forward_backward(float const *__restrict__ x_pred,
+                                         float const *__restrict__ x_true,
+                                         float *__restrict__ d_x,
+                                         int32_t size,
+                                         float d_y,
+                                         int32_t loss_weighted) -> float
 {
-  for (int32_t i = 0; i < size; ++i)
+  int32_t constexpr block_size = 256;
+
+  v128_t gradient_scale = wasm_f32x4_splat(2.0f * d_y / size);
+
+  // Each block is summed on its own, and the block sums are added to the total with Kahan compensation, so
+  // float accumulation stays accurate over a whole set of heatmaps.
+  v128_t total = wasm_f32x4_splat(0.0f);
+  v128_t compensation = wasm_f32x4_splat(0.0f);
+  for (int32_t start = 0; start < size; start += block_size)
+  {
+    int32_t end = min(start + block_size, size);
+
+    v128_t block_sum = wasm_f32x4_splat(0.0f);
+    for (int32_t i = start; i < end; i += 4)
+    {
+      v128_t error = wasm_f32x4_sub(load_lanes(x_pred + i, end - i), load_lanes(x_true + i, end - i));
+      block_sum = wasm_f32x4_add(block_sum, wasm_f32x4_mul(error, error));
+      if (d_x != nullptr)
+      {
+        store_lanes(d_x + i, wasm_f32x4_mul(error, gradient_scale), end - i);
+      }
+    }
+
+    v128_t y = wasm_f32x4_sub(block_sum, compensation);
+    v128_t t = wasm_f32x4_add(total, y);
+    compensation = wasm_f32x4_sub(wasm_f32x4_sub(t, total), y);
+    total = t;
+  }
+
+  total = wasm_f32x4_sub(total, compensation);
+  float sum = (wasm_f32x4_extract_lane(total, 0) + wasm_f32x4_extract_lane(total, 1)) +
+              (wasm_f32x4_extract_lane(total, 2) + wasm_f32x4_extract_lane(total, 3));
+  float loss = sum / size;
+
+  if (d_x != nullptr && loss_weighted)
   {
-    // d_x[i] += 2.0f * (x_pred[i] - x_true[i]) / size * d_y;
-    d_x[i] = 2.0f * (x_pred[i] - x_true[i]) / size * d_y;
+    multiply(d_x, size, loss);
   }
+
+  return loss;
 }
 
-auto update_parameters(float const *__restrict__ gradients,
+auto update_parameters(float *__restrict__ gradients,
                        float *__restrict__ parameters,
                        float *__restrict__ m,
                        float *__restrict__ v,
@@ -2192,51 +4674,101 @@ auto update_parameters(float const *__restrict__ gradients,
                        float beta_1,
                        float beta_2,
                        float epsilon,
-                       [[maybe_unused]] float schedule_multiplier,
+                       float schedule_multiplier,
                        float learning_rate,
-                       [[maybe_unused]] float weight_decay,
+                       float weight_decay,
                        int32_t t) -> void
 {
-  float beta_1_pow_t = pow(beta_1, t);
-  float beta_2_pow_t = pow(beta_2, t);
+  adamw_step step = make_adamw_step(beta_1, beta_2, epsilon, schedule_multiplier, learning_rate, weight_decay, t);
 
-  for (int32_t i = 0; i < size; ++i)
+  // The gradients are zeroed as they are consumed, ready for the next batch to accumulate into.
+  for (int32_t i = 0; i < size; i += 4)
   {
-    m[i] = beta_1 * m[i] + (1.0f - beta_1) * gradients[i];
-    v[i] = beta_2 * v[i] + (1.0f - beta_2) * square(gradients[i]);
+    adamw_update(step, gradients + i, parameters + i, m + i, v + i, size - i);
+  }
+}
+
+auto update_pointwise_convolution_kernel(float *__restrict__ gradients,
+                                         float *__restrict__ kernel,
+                                         float *__restrict__ m,
+                                         float *__restrict__ v,
+                                         float *__restrict__ packed_kernel,
+                                         float *__restrict__ packed_kernel_transposed,
+                                         int32_t channels_in,
+                                         int32_t channels_out,
+                                         float beta_1,
+                                         float beta_2,
+                                         float epsilon,
+                                         float schedule_multiplier,
+                                         float learning_rate,
+                                         float weight_decay,
+                                         int32_t t) -> void
+{
+  adamw_step step = make_adamw_step(beta_1, beta_2, epsilon, schedule_multiplier, learning_rate, weight_decay, t);
 
-    float m_ = m[i] / (1.0f - beta_1_pow_t);
-    float v_ = v[i] / (1.0f - beta_2_pow_t);
+  // update_parameters for a kernel, which also writes each new weight into the layouts of
+  // pack_pointwise_convolution_kernel when they are given. The zero padding of the panels is never touched.
+  for (int32_t i_k = 0; i_k < channels_in; ++i_k)
+  {
+    for (int32_t i_n = 0; i_n < channels_out; i_n += 4)
+    {
+      int32_t i = i_k * channels_out + i_n;
+      int32_t lanes = min(4, channels_out - i_n);
+      v128_t p = adamw_update(step, gradients + i, kernel + i, m + i, v + i, lanes);
 
-    // parameters[i] = parameters[i] - (learning_rate * m_ / (__builtin_sqrtf(v_) + epsilon) + weight_decay * parameters[i]);
-    parameters[i] = parameters[i] - (learning_rate * m_ / (__builtin_sqrtf(v_) + epsilon));
+      if (packed_kernel != nullptr)
+      {
+        store_lanes(packed_kernel + (i_n / 8) * 8 * channels_in + i_k * 8 + i_n % 8, p, lanes);
+      }
+      if (packed_kernel_transposed != nullptr)
+      {
+        float values[4];
+        wasm_v128_store(values, p);
+        for (int32_t j = 0; j < lanes; ++j)
+        {
+          packed_kernel_transposed[(i_k / 8) * 8 * channels_out + (i_n + j) * 8 + i_k % 8] = values[j];
+        }
+      }
+    }
   }
 }
 
-auto mean(float const *__restrict__ x, int32_t size) -> float
+// Sums exp(-(i + 0.5 - center)^2 / (2 sigma^2)) and its square over i in [0, size). The sums are kept in double
+// because the variance is recovered from their difference, which cancels badly for wide Gaussians.
+auto gaussian_sums(int32_t size, float center, float sigma, double &sum, double &sum_of_squares) -> void
 {
-  float result = 0.0f;
+  v128_t negative_reciprocal_two_sigma_squared = wasm_f32x4_splat(-1.0f / (2.0f * square(sigma)));
 
-  for (int32_t i = 0; i < size; ++i)
+  sum = 0.0;
+  sum_of_squares = 0.0;
+  for (int32_t i = 0; i < size; i += 4)
   {
-    result += x[i];
+    v128_t x = wasm_f32x4_sub(wasm_f32x4_add(wasm_f32x4_splat(i), wasm_f32x4_make(0.5f, 1.5f, 2.5f, 3.5f)), wasm_f32x4_splat(center));
+
+    float values[4];
+    wasm_v128_store(values, exp_f32x4(wasm_f32x4_mul(wasm_f32x4_mul(x, x), negative_reciprocal_two_sigma_squared)));
+    for (int32_t j = 0; j < min(4, size - i); ++j)
+    {
+      sum += values[j];
+      sum_of_squares += square(static_cast<double>(values[j]));
+    }
   }
-  result /= size;
-  return result;
 }
 
-auto std_dev(float const *__restrict__ x, int32_t size, float mean) -> float
+// The pixels [low, high] of one axis whose centers, at i + 0.5, are within radius of center. Returns false when
+// there are none, as for keypoints far enough outside the image.
+auto gaussian_window(float center, float radius, int32_t size, int32_t &low, int32_t &high) -> bool
 {
-  float result = 0.0f;
-
-  for (int32_t i = 0; i < size; ++i)
+  float window_low = max(0.0f, __builtin_ceilf(center - 0.5f - radius));
+  float window_high = min(size - 1.0f, __builtin_floorf(center - 0.5f + radius));
+  if (!(window_low <= window_high))
   {
-    result += square(x[i] - mean);
+    return false;
   }
-  result /= size;
-  result = __builtin_sqrtf(result);
-  // result = __builtin_sqrtf(result + epsilon);
-  return result;
+
+  low = window_low;
+  high = window_high;
+  return true;
 }
 
 auto draw_gaussians(float *__restrict__ data,
@@ -2246,40 +4778,220 @@ auto draw_gaussians(float *__restrict__ data,
                     float const *__restrict__ coords,
                     float sigma) -> void
 {
-  float center_y = height / 2.0f;
-  float center_x = width / 2.0f;
+  // Every heatmap is normalized by the mean and standard deviation of a Gaussian centered in the image. The
+  // Gaussian is separable, so both follow from sums over one row and one column.
+  double sum_y;
+  double sum_of_squares_y;
+  double sum_x;
+  double sum_of_squares_x;
+  gaussian_sums(height, height / 2.0f, sigma, sum_y, sum_of_squares_y);
+  gaussian_sums(width, width / 2.0f, sigma, sum_x, sum_of_squares_x);
 
-  for (int32_t h = 0; h < height; ++h)
+  double size = static_cast<double>(height) * width;
+  double m = sum_y * sum_x / size;
+  double s = __builtin_sqrt(max(0.0, sum_of_squares_y * sum_of_squares_x / size - square(m)));
+
+  float scale = static_cast<float>(1.0 / s);
+  float offset = static_cast<float>(-m / s);
+
+  // Past 4 sigma a Gaussian is below exp(-8), so everything outside a window of that radius around each keypoint
+  // is written as the normalized value of zero.
+  v128_t background = wasm_f32x4_splat(offset);
+  for (int32_t i = 0; i < height * width * channels; i += 4)
   {
-    for (int32_t w = 0; w < width; ++w)
+    store_lanes(data + i, background, height * width * channels - i);
+  }
+
+  float radius = 4.0f * sigma;
+  float negative_reciprocal_two_sigma_squared = -1.0f / (2.0f * square(sigma));
+
+  // Inside the window each value is the product of a row and a column factor, with scale folded into the row
+  // factor. The column factors are evaluated a chunk at a time.
+  int32_t constexpr chunk_size = 64;
+  float column_factors[chunk_size];
+
+  for (int32_t c = 0; c < channels; ++c)
+  {
+    float y = coords[c * 2 + 0];
+    float x = coords[c * 2 + 1];
+
+    int32_t h_low;
+    int32_t h_high;
+    int32_t w_low;
+    int32_t w_high;
+    if (!gaussian_window(y, radius, height, h_low, h_high) || !gaussian_window(x, radius, width, w_low, w_high))
+    {
+      continue;
+    }
+
+    for (int32_t w_start = w_low; w_start <= w_high; w_start += chunk_size)
     {
-      float left_top = square(w + 0.5f - center_x);
-      float right_top = square(h + 0.5f - center_y);
-      float inner = (left_top + right_top) / (2.0f * square(sigma));
+      int32_t columns = min(chunk_size, w_high - w_start + 1);
+      for (int32_t j = 0; j < columns; j += 4)
+      {
+        v128_t d_x = wasm_f32x4_sub(wasm_f32x4_add(wasm_f32x4_splat(w_start + j + 0.5f), wasm_f32x4_make(0.0f, 1.0f, 2.0f, 3.0f)), wasm_f32x4_splat(x));
+        wasm_v128_store(column_factors + j, exp_f32x4(wasm_f32x4_mul(wasm_f32x4_mul(d_x, d_x), wasm_f32x4_splat(negative_reciprocal_two_sigma_squared))));
+      }
+
+      for (int32_t h = h_low; h <= h_high; ++h)
+      {
+        v128_t d_y = wasm_f32x4_splat(h + 0.5f - y);
+        float row_factor = wasm_f32x4_extract_lane(exp_f32x4(wasm_f32x4_mul(wasm_f32x4_mul(d_y, d_y), wasm_f32x4_splat(negative_reciprocal_two_sigma_squared))), 0) * scale;
 
-      data[h * width + w] = exp(-inner);
+        float *row = data + h * width * channels + w_start * channels + c;
+        for (int32_t j = 0; j < columns; ++j)
+        {
+          row[j * channels] = row_factor * column_factors[j] + offset;
+        }
+      }
     }
   }
+}
 
-  float m = mean(data, height * width);
-  float s = std_dev(data, height * width, m);
+// The loss of mean_squared_error_forward_backward against heatmaps from draw_gaussians, computed exactly inside
+// each keypoint's 4 sigma window and estimated elsewhere from sample_count uniformly drawn elements (indices into
+// x_pred). Samples that land inside a window are already counted exactly and are dropped, and the rest are
+// weighted by size / sample_count, which keeps the loss and its gradient unbiased.
+//
+// d_x is only written in the rows of the pre-shuffle (scale 4) grid that hold a window or a sample, which are
+// listed in rows, and is zero within them. row_flags holds one flag per row and must be zero on entry; it is left
+// zero on return. loss_weighted scales the gradient by the loss estimate, as in mean_squared_error_forward_backward,
+// over the listed rows only.
+auto sparse_mean_squared_error_forward_backward(float const *__restrict__ x_pred,
+                                                float const *__restrict__ x_true,
+                                                float *__restrict__ d_x,
+                                                float const *__restrict__ coords,
+                                                int32_t const *__restrict__ samples,
+                                                int32_t sample_count,
+                                                int32_t *__restrict__ rows,
+                                                int32_t *__restrict__ row_count,
+                                                int32_t *__restrict__ row_flags,
+                                                int32_t height,
+                                                int32_t width,
+                                                int32_t channels,
+                                                float sigma,
+                                                float d_y,
+                                                int32_t loss_weighted) -> float
+{
+  int32_t constexpr scale = 4;
 
-  for (int32_t h = 0; h < height; ++h)
+  int32_t rows_width = width / scale;
+  float radius = 4.0f * sigma;
+  float size = static_cast<float>(height) * width * channels;
+
+  int32_t count = 0;
+  auto add_row = [&](int32_t row) -> void
   {
-    for (int32_t w = 0; w < width; ++w)
+    if (!row_flags[row])
+    {
+      row_flags[row] = 1;
+      rows[count++] = row;
+    }
+  };
+
+  for (int32_t c = 0; c < channels; ++c)
+  {
+    int32_t h_low;
+    int32_t h_high;
+    int32_t w_low;
+    int32_t w_high;
+    if (gaussian_window(coords[c * 2 + 0], radius, height, h_low, h_high) &&
+        gaussian_window(coords[c * 2 + 1], radius, width, w_low, w_high))
+    {
+      for (int32_t h = h_low / scale; h <= h_high / scale; ++h)
+      {
+        for (int32_t w = w_low / scale; w <= w_high / scale; ++w)
+        {
+          add_row(h * rows_width + w);
+        }
+      }
+    }
+  }
+  for (int32_t k = 0; k < sample_count; ++k)
+  {
+    int32_t pixel = samples[k] / channels;
+    add_row((pixel / width / scale) * rows_width + (pixel % width) / scale);
+  }
+
+  for (int32_t i = 0; i < count; ++i)
+  {
+    int32_t h = (rows[i] / rows_width) * scale;
+    int32_t w = (rows[i] % rows_width) * scale;
+    for (int32_t j = 0; j < scale; ++j)
     {
-      for (int32_t c = 0; c < channels; ++c)
+      zero(d_x + ((h + j) * width + w) * channels, scale * channels);
+    }
+  }
+
+  float gradient_scale = 2.0f * d_y / size;
+
+  float window_sum = 0.0f;
+  for (int32_t c = 0; c < channels; ++c)
+  {
+    int32_t h_low;
+    int32_t h_high;
+    int32_t w_low;
+    int32_t w_high;
+    if (gaussian_window(coords[c * 2 + 0], radius, height, h_low, h_high) &&
+        gaussian_window(coords[c * 2 + 1], radius, width, w_low, w_high))
+    {
+      for (int32_t h = h_low; h <= h_high; ++h)
       {
-        float left_top = square(w + 0.5f - coords[c * 2 + 1]);
-        float right_top = square(h + 0.5f - coords[c * 2 + 0]);
-        float inner = (left_top + right_top) / (2.0f * square(sigma));
+        for (int32_t w = w_low; w <= w_high; ++w)
+        {
+          int32_t i = (h * width + w) * channels + c;
+          float error = x_pred[i] - x_true[i];
+          window_sum += square(error);
+          d_x[i] = error * gradient_scale;
+        }
+      }
+    }
+  }
+
+  float sample_weight = sample_count > 0 ? size / sample_count : 0.0f;
+
+  float background_sum = 0.0f;
+  for (int32_t k = 0; k < sample_count; ++k)
+  {
+    int32_t i = samples[k];
+    int32_t c = i % channels;
+    int32_t h = i / channels / width;
+    int32_t w = i / channels % width;
+
+    int32_t h_low;
+    int32_t h_high;
+    int32_t w_low;
+    int32_t w_high;
+    if (gaussian_window(coords[c * 2 + 0], radius, height, h_low, h_high) &&
+        gaussian_window(coords[c * 2 + 1], radius, width, w_low, w_high) &&
+        h >= h_low && h <= h_high && w >= w_low && w <= w_high)
+    {
+      continue;
+    }
+
+    float error = x_pred[i] - x_true[i];
+    background_sum += square(error);
+    d_x[i] += error * gradient_scale * sample_weight;
+  }
+
+  float loss = (window_sum + sample_weight * background_sum) / size;
 
-        data[h * width * channels + w * channels + c] = exp(-inner);
-        data[h * width * channels + w * channels + c] -= m;
-        data[h * width * channels + w * channels + c] /= s;
+  for (int32_t i = 0; i < count; ++i)
+  {
+    if (loss_weighted)
+    {
+      int32_t h = (rows[i] / rows_width) * scale;
+      int32_t w = (rows[i] % rows_width) * scale;
+      for (int32_t j = 0; j < scale; ++j)
+      {
+        multiply(d_x + ((h + j) * width + w) * channels, scale * channels, loss);
       }
     }
+    row_flags[rows[i]] = 0;
   }
+  *row_count = count;
+
+  return loss;
 }
 
 auto rgb_to_gray(float const *__restrict__ x,
@@ -2341,14 +5053,62 @@ auto resize_bilinear_rgba_to_rgb(uint8_t const *x,
   }
 }
 
+auto resize_bilinear_rgba(uint8_t const *__restrict__ x,
+                          uint8_t *__restrict__ y,
+                          int32_t x_height,
+                          int32_t x_width,
+                          int32_t y_height,
+                          int32_t y_width) -> void
+{
+  // Same sampling as resize_bilinear_rgba_to_rgb, but the result stays in 8-bit RGBA so the network can
+  // read it directly.
+  float h_ratio = (x_height - 1.0f) / (y_height - 1.0f);
+  float w_ratio = (x_width - 1.0f) / (y_width - 1.0f);
+
+  for (int32_t h = 0; h < y_height; ++h)
+  {
+    int32_t h_low = max(0.0f, __builtin_floorf(h_ratio * h));
+    int32_t h_high = min(x_height - 1.0f, __builtin_ceilf(h_ratio * h));
+
+    float y_weight = (h_ratio * h) - h_low;
+
+    for (int32_t w = 0; w < y_width; ++w)
+    {
+      int32_t w_low = max(0.0f, __builtin_floorf(w_ratio * w));
+      int32_t w_high = min(x_width - 1.0f, __builtin_ceilf(w_ratio * w));
+
+      float x_weight = (w_ratio * w) - w_low;
+
+      for (int32_t c = 0; c < channels_rgba; ++c)
+      {
+        float a_ = x[h_low * x_width * channels_rgba + w_low * channels_rgba + c];
+        float b_ = x[h_low * x_width * channels_rgba + w_high * channels_rgba + c];
+        float c_ = x[h_high * x_width * channels_rgba + w_low * channels_rgba + c];
+        float d_ = x[h_high * x_width * channels_rgba + w_high * channels_rgba + c];
+
+        float value = 0.0f;
+        value += a_ * (1.0f - x_weight) * (1.0f - y_weight);
+        value += b_ * x_weight * (1.0f - y_weight);
+        value += c_ * (1.0f - x_weight) * y_weight;
+        value += d_ * x_weight * y_weight;
+
+        y[h * y_width * channels_rgba + w * channels_rgba + c] = static_cast<uint8_t>(value + 0.5f);
+      }
+    }
+  }
+}
+
 auto rotate_bilinear(float const *__restrict__ original,
                      float *__restrict__ rotated,
                      int32_t height,
                      int32_t width,
                      float theta) -> void
 {
-  float cos_theta = cos(theta);
-  float sin_theta = sin(theta);
+  v128_t sine;
+  v128_t cosine;
+  sin_cos_f32x4(wasm_f32x4_splat(theta), sine, cosine);
+  float cos_theta = wasm_f32x4_extract_lane(cosine, 0);
+  float sin_theta = wasm_f32x4_extract_lane(sine, 0);
   float rotation_matrix[4] = {cos_theta, sin_theta, -sin_theta, cos_theta};
 
   float mean = 0.0f;
@@ -2445,8 +5205,9 @@ auto adjust_brightness(float *x, int32_t height, int32_t width, float brightness
 
 auto adjust_gamma(float *x, int32_t height, int32_t width, float gamma) -> void
 {
-  for (int32_t i = 0; i < height * width * channels_rgb; ++i)
+  for (int32_t i = 0; i < height * width * channels_rgb; i += 4)
   {
-    x[i] = pow(x[i], gamma);
+    int32_t lanes = min(4, height * width * channels_rgb - i);
+    store_lanes(x + i, pow_f32x4(load_lanes(x + i, lanes), gamma), lanes);
   }
 }
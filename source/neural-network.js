@@ -35,6 +35,7 @@ const instance = await WebAssembly.instantiate(
   neuralNetworkWasmModule,
   {
     env: {
+      // Only imported by builds with -DIMPORTED_MATH, which use them as a reference for the in-module versions.
       exp: (x) => { return Math.exp(x); },
       pow: (base, exponent) => { return Math.pow(base, exponent); },
       cos: (x) => { return Math.cos(x); },
@@ -47,6 +48,16 @@ instance.exports._start();
 const memoryPageSize = 64 * 1024;
 const elementByteSize = 4;
 
+// A channel-blocked (NHWc4) tensor stores its channels rounded up to whole blocks of 4.
+function storedChannels(channels, blocked) {
+  return blocked ? Math.ceil(channels / 4) * 4 : channels;
+}
+
+// A half-precision (bfloat16) tensor packs two values into every element of its buffer.
+function storedSize(size, halfPrecision) {
+  return halfPrecision ? Math.ceil(size / 2) : size;
+}
+
 
 class Layer {
   upstreamLayers = [];
@@ -55,22 +66,48 @@ class Layer {
   parameterOffsets = [];
   gradientSizes = [];
   gradientOffsets = [];
+  packedParameterSizes = [];
+  packedParameterOffsets = [];
+  quantizedParameterSizes = [];
+  quantizedParameterOffsets = [];
   bufferSizes = [];
   bufferOffsets = [];
 
   currentHeight = null;
   currentWidth = null;
   currentChannels = null;
+  blocked = false; // Whether the forward output and the gradient flowing into it are channel-blocked
+  halfPrecision = false; // Whether the forward output is stored as bfloat16
+  needsInputGradient = true; // Whether any upstream layer consumes the gradient with respect to this layer's input
+  trainable = true; // Whether the network is built for training, which needs the buffers only backward reads
+  bufferSource = null; // The layer whose buffers this layer reuses instead of having its own
 
   constructor() { }
   initializeParametersAndGradients() { }
+  packParameters() { }
+  quantizeParameters(inputScale) { }
   zeroGradients() { }
   bufferSizesFor(height, width, channels) { }
   outputShapeFor(height, width, channels) { }
   forward() { }
+
+  // One AdamW step on parameter index, which also zeroes its gradient.
+  updateParameter(index, firstMomentOffset, secondMomentOffset, hyperparameters) {
+    instance.exports.update_parameters(
+      this.gradientOffsets[index],
+      this.parameterOffsets[index],
+      firstMomentOffset,
+      secondMomentOffset,
+      this.parameterSizes[index],
+      ...hyperparameters
+    );
+  }
+
   backward() { }
   currentForwardOutput() { }
   currentBackwardOutput() { }
+  requestStatistics() { }
+  currentStatistics() { return null; }
   setTrainingMode() { }
   setInferenceMode() { }
 }
@@ -218,13 +255,13 @@ class AdditionLayer extends Layer {
 
   backward() {
     let [inputOffset, inputHeight, inputWidth, inputChannels] = this.upstreamLayers[0].currentForwardOutput();
-    instance.exports.zero(this.bufferOffsets[1], this.bufferSizes[1]);
 
-    for (const downstreamLayer of this.downstreamLayers) {
+    for (const [index, downstreamLayer] of this.downstreamLayers.entries()) {
       instance.exports.add_backward(
         downstreamLayer.currentBackwardOutput()[0],
         this.bufferOffsets[1],
-        this.bufferSizes[1]
+        this.bufferSizes[1],
+        index > 0 ? 1 : 0
       );
     }
   }
@@ -292,14 +329,14 @@ class HardSwishLayer extends Layer {
 
   backward() {
     let [inputOffset, inputHeight, inputWidth, inputChannels] = this.upstreamLayers[0].currentForwardOutput();
-    instance.exports.zero(this.bufferOffsets[1], this.bufferSizes[1]);
 
-    for (const downstreamLayer of this.downstreamLayers) {
+    for (const [index, downstreamLayer] of this.downstreamLayers.entries()) {
       instance.exports.hard_swish_backward(
         downstreamLayer.currentBackwardOutput()[0],
         this.bufferOffsets[1],
         inputOffset,
-        this.bufferSizes[1]
+        this.bufferSizes[1],
+        index > 0 ? 1 : 0
       );
     }
   }
@@ -403,16 +440,16 @@ class DropoutLayer extends Layer {
 
   backward() {
     let [inputOffset, inputHeight, inputWidth, inputChannels] = this.upstreamLayers[0].currentForwardOutput();
-    instance.exports.zero(this.bufferOffsets[1], this.bufferSizes[1]);
 
-    for (const downstreamLayer of this.downstreamLayers) {
+    for (const [index, downstreamLayer] of this.downstreamLayers.entries()) {
       instance.exports.dropout_backward(
         downstreamLayer.currentBackwardOutput()[0],
         this.bufferOffsets[1],
         this.bufferOffsets[2],
         inputHeight,
         inputWidth,
-        inputChannels
+        inputChannels,
+        index > 0 ? 1 : 0
       );
     }
   }
@@ -514,15 +551,15 @@ class PixelUnshuffleLayer extends Layer {
 
   backward() {
     let [inputOffset, inputHeight, inputWidth, inputChannels] = this.upstreamLayers[0].currentForwardOutput();
-    instance.exports.zero(this.bufferOffsets[1], this.bufferSizes[1]);
 
-    for (const downstreamLayer of this.downstreamLayers) {
+    for (const [index, downstreamLayer] of this.downstreamLayers.entries()) {
       instance.exports.pixel_unshuffle_backward(
         downstreamLayer.currentBackwardOutput()[0],
         this.bufferOffsets[1],
         Math.trunc(inputHeight / this.stride),
         Math.trunc(inputWidth / this.stride),
-        inputChannels * (this.stride * this.stride)
+        inputChannels * (this.stride * this.stride),
+        index > 0 ? 1 : 0
       );
     }
   }
@@ -597,15 +634,15 @@ class PixelShuffleLayer extends Layer {
 
   backward() {
     let [inputOffset, inputHeight, inputWidth, inputChannels] = this.upstreamLayers[0].currentForwardOutput();
-    instance.exports.zero(this.bufferOffsets[1], this.bufferSizes[1]);
 
-    for (const downstreamLayer of this.downstreamLayers) {
+    for (const [index, downstreamLayer] of this.downstreamLayers.entries()) {
       instance.exports.pixel_shuffle_backward(
         downstreamLayer.currentBackwardOutput()[0],
         this.bufferOffsets[1],
         inputHeight,
         inputWidth,
-        inputChannels
+        inputChannels,
+        index > 0 ? 1 : 0
       );
     }
   }
@@ -642,6 +679,9 @@ class InstanceNormalizationLayer extends Layer {
 
     this.channels = channels;
     this.epsilon = epsilon;
+    this.blocked = upstreamLayer.blocked;
+
+    upstreamLayer.requestStatistics();
 
     const gammaSize = this.channels;
     const betaSize = this.channels;
@@ -654,10 +694,6 @@ class InstanceNormalizationLayer extends Layer {
     this.bufferSizes.push(null);
     this.bufferSizes.push(null);
     this.bufferSizes.push(null);
-    this.bufferSizes.push(null);
-    this.bufferSizes.push(null);
-    this.bufferOffsets.push(null);
-    this.bufferOffsets.push(null);
     this.bufferOffsets.push(null);
     this.bufferOffsets.push(null);
     this.bufferOffsets.push(null);
@@ -696,12 +732,10 @@ class InstanceNormalizationLayer extends Layer {
   bufferSizesFor(height, width, channels) {
     const bufferSizes = [];
 
-    bufferSizes.push(height * width * channels);
-    bufferSizes.push(height * width * channels);
+    bufferSizes.push(height * width * storedChannels(channels, this.blocked));
+    bufferSizes.push(height * width * storedChannels(channels, this.blocked));
     bufferSizes.push(channels); // sample_mean
     bufferSizes.push(channels); // sample_std_dev
-    bufferSizes.push(channels); // sum_1
-    bufferSizes.push(channels); // sum_2
 
     return bufferSizes;
   }
@@ -712,19 +746,40 @@ class InstanceNormalizationLayer extends Layer {
 
   forward() {
     let [inputOffset, inputHeight, inputWidth, inputChannels] = this.upstreamLayers[0].currentForwardOutput();
+    const statistics = this.upstreamLayers[0].currentStatistics();
 
-    instance.exports.instance_normalization_forward(
-      inputOffset,
-      this.bufferOffsets[0],
-      this.parameterOffsets[0],
-      this.parameterOffsets[1],
-      this.bufferOffsets[2],
-      this.bufferOffsets[3],
-      this.epsilon,
-      inputHeight,
-      inputWidth,
-      inputChannels
-    );
+    if (statistics !== null) {
+      let [sumOffset, sumOfSquaresOffset] = statistics;
+      instance.exports.instance_normalization_forward_from_sums(
+        inputOffset,
+        this.bufferOffsets[0],
+        this.parameterOffsets[0],
+        this.parameterOffsets[1],
+        this.bufferOffsets[2],
+        this.bufferOffsets[3],
+        sumOffset,
+        sumOfSquaresOffset,
+        this.epsilon,
+        inputHeight,
+        inputWidth,
+        inputChannels,
+        this.blocked ? 1 : 0
+      );
+    } else {
+      instance.exports.instance_normalization_forward(
+        inputOffset,
+        this.bufferOffsets[0],
+        this.parameterOffsets[0],
+        this.parameterOffsets[1],
+        this.bufferOffsets[2],
+        this.bufferOffsets[3],
+        this.epsilon,
+        inputHeight,
+        inputWidth,
+        inputChannels,
+        this.blocked ? 1 : 0
+      );
+    }
 
     this.currentHeight = inputHeight;
     this.currentWidth = inputWidth;
@@ -733,11 +788,8 @@ class InstanceNormalizationLayer extends Layer {
 
   backward() {
     let [inputOffset, inputHeight, inputWidth, inputChannels] = this.upstreamLayers[0].currentForwardOutput();
-    instance.exports.zero(this.bufferOffsets[1], this.bufferSizes[1]);
-    instance.exports.zero(this.bufferOffsets[4], this.bufferSizes[4]);
-    instance.exports.zero(this.bufferOffsets[5], this.bufferSizes[5]);
 
-    for (const downstreamLayer of this.downstreamLayers) {
+    for (const [index, downstreamLayer] of this.downstreamLayers.entries()) {
       instance.exports.instance_normalization_backward(
         downstreamLayer.currentBackwardOutput()[0],
         this.bufferOffsets[1],
@@ -747,11 +799,11 @@ class InstanceNormalizationLayer extends Layer {
         this.bufferOffsets[2],
         this.bufferOffsets[3],
         inputOffset,
-        this.bufferOffsets[4],
-        this.bufferOffsets[5],
         inputHeight,
         inputWidth,
-        inputChannels
+        inputChannels,
+        this.blocked ? 1 : 0,
+        index > 0 ? 1 : 0
       );
     }
   }
@@ -780,8 +832,11 @@ class PointwiseConvolutionLayer extends Layer {
   channelsIn = null;
   channelsOut = null;
   gain = null;
+  inputRange = 0; // The largest input magnitude seen by NeuralNetwork.calibrate()
+  inputScale = null;
 
-  constructor(upstreamLayer, channelsIn, channelsOut, gain = 1.0) {
+  // The input keeps the layout of the upstream layer; blocked selects the layout of the output.
+  constructor(upstreamLayer, channelsIn, channelsOut, gain = 1.0, blocked = false) {
     super();
     upstreamLayer.downstreamLayers.push(this);
     this.upstreamLayers.push(upstreamLayer);
@@ -789,6 +844,8 @@ class PointwiseConvolutionLayer extends Layer {
     this.channelsIn = channelsIn;
     this.channelsOut = channelsOut;
     this.gain = gain;
+    this.blocked = blocked;
+    this.training = false;
 
     const kernelSize = this.channelsIn * this.channelsOut;
     const biasSize = this.channelsOut;
@@ -797,12 +854,20 @@ class PointwiseConvolutionLayer extends Layer {
     this.gradientSizes.push(kernelSize);
     this.gradientSizes.push(biasSize);
 
+    const packedKernelSize = Math.ceil(this.channelsOut / 8) * 8 * this.channelsIn;
+    const packedKernelTransposedSize = Math.ceil(this.channelsIn / 8) * 8 * this.channelsOut;
+    this.packedParameterSizes.push(packedKernelSize);
+    this.packedParameterSizes.push(packedKernelTransposedSize);
+
+    // The int8 kernel (4 weights per element) and its per-output-channel scales.
+    const quantizedKernelSize = Math.ceil(Math.ceil(this.channelsOut / 8) * 8 * Math.ceil(this.channelsIn / 2) * 2 / 4);
+    this.quantizedParameterSizes.push(quantizedKernelSize);
+    this.quantizedParameterSizes.push(this.channelsOut);
+
     this.bufferSizes.push(null);
     this.bufferSizes.push(null);
-    this.bufferSizes.push(null); // kernel buffer
     this.bufferOffsets.push(null);
     this.bufferOffsets.push(null);
-    this.bufferOffsets.push(null); // kernel buffer
   }
 
   initializeParametersAndGradients() {
@@ -833,6 +898,36 @@ class PointwiseConvolutionLayer extends Layer {
     }
   }
 
+  packParameters() {
+    instance.exports.pack_pointwise_convolution_kernel(
+      this.parameterOffsets[0],
+      this.packedParameterOffsets[0],
+      this.packedParameterOffsets[1],
+      this.channelsIn,
+      this.channelsOut
+    );
+  }
+
+  updateParameter(index, firstMomentOffset, secondMomentOffset, hyperparameters) {
+    if (index !== 0) {
+      super.updateParameter(index, firstMomentOffset, secondMomentOffset, hyperparameters);
+      return;
+    }
+
+    // The packed kernels are rewritten in the same pass, so no packParameters is needed after an update.
+    instance.exports.update_pointwise_convolution_kernel(
+      this.gradientOffsets[0],
+      this.parameterOffsets[0],
+      firstMomentOffset,
+      secondMomentOffset,
+      this.packedParameterOffsets[0],
+      this.packedParameterOffsets[1],
+      this.channelsIn,
+      this.channelsOut,
+      ...hyperparameters
+    );
+  }
+
   zeroGradients() {
     instance.exports.zero(this.gradientOffsets[0], this.gradientSizes[0]);
     instance.exports.zero(this.gradientOffsets[1], this.gradientSizes[1]);
@@ -841,9 +936,8 @@ class PointwiseConvolutionLayer extends Layer {
   bufferSizesFor(height, width, channels) {
     const bufferSizes = [];
 
-    bufferSizes.push(height * width * this.channelsOut); // y
-    bufferSizes.push(height * width * this.channelsIn); // d_x
-    bufferSizes.push(this.parameterSizes[0]); // kernel buffer
+    bufferSizes.push(height * width * storedChannels(this.channelsOut, this.blocked)); // y
+    bufferSizes.push(height * width * storedChannels(this.channelsIn, this.upstreamLayers[0].blocked)); // d_x
 
     return bufferSizes;
   }
@@ -858,12 +952,14 @@ class PointwiseConvolutionLayer extends Layer {
     instance.exports.pointwise_convolution_forward(
       inputOffset,
       this.bufferOffsets[0],
-      this.parameterOffsets[0],
+      this.packedParameterOffsets[0],
       this.parameterOffsets[1],
       inputHeight,
       inputWidth,
       this.channelsIn,
-      this.channelsOut
+      this.channelsOut,
+      this.upstreamLayers[0].blocked ? 1 : 0,
+      this.blocked ? 1 : 0
     );
 
     this.currentHeight = inputHeight;
@@ -873,25 +969,88 @@ class PointwiseConvolutionLayer extends Layer {
 
   backward() {
     let [inputOffset, inputHeight, inputWidth, inputChannels] = this.upstreamLayers[0].currentForwardOutput();
-    instance.exports.zero(this.bufferOffsets[1], this.bufferSizes[1]);
 
-    for (const downstreamLayer of this.downstreamLayers) {
+    for (const [index, downstreamLayer] of this.downstreamLayers.entries()) {
       instance.exports.pointwise_convolution_backward(
         downstreamLayer.currentBackwardOutput()[0],
-        this.bufferOffsets[1],
+        this.needsInputGradient ? this.bufferOffsets[1] : 0,
         this.gradientOffsets[0],
         this.gradientOffsets[1],
         inputOffset,
-        this.parameterOffsets[0],
-        this.bufferOffsets[2],
+        this.packedParameterOffsets[1],
         inputHeight,
         inputWidth,
         this.channelsIn,
-        this.channelsOut
+        this.channelsOut,
+        this.upstreamLayers[0].blocked ? 1 : 0,
+        this.blocked ? 1 : 0,
+        index > 0 ? 1 : 0
       );
     }
   }
 
+  quantizeParameters(inputScale) {
+    this.inputScale = inputScale;
+    instance.exports.quantize_pointwise_convolution_kernel(
+      this.parameterOffsets[0],
+      this.quantizedParameterOffsets[0],
+      this.quantizedParameterOffsets[1],
+      this.channelsIn,
+      this.channelsOut
+    );
+  }
+
+  // Inference forward with the int8 kernel; scratchOffset needs quantizedScratchSize() elements.
+  forwardQuantized(scratchOffset) {
+    let [inputOffset, inputHeight, inputWidth, inputChannels] = this.upstreamLayers[0].currentForwardOutput();
+
+    instance.exports.quantized_pointwise_convolution_forward(
+      inputOffset,
+      this.bufferOffsets[0],
+      this.quantizedParameterOffsets[0],
+      this.quantizedParameterOffsets[1],
+      this.parameterOffsets[1],
+      scratchOffset,
+      this.inputScale,
+      inputHeight,
+      inputWidth,
+      this.channelsIn,
+      this.channelsOut,
+      0
+    );
+
+    this.currentHeight = inputHeight;
+    this.currentWidth = inputWidth;
+    this.currentChannels = this.channelsOut;
+  }
+
+  quantizedScratchSize() {
+    return Math.ceil(this.channelsIn / 2) * 2; // 4 pixels of int8 input
+  }
+
+  // The backward through this layer and the 4x pixel shuffle after it, for a shuffled gradient that is zero outside
+  // the rowCount rows listed at rowsOffset.
+  backwardSparse(gradient, rowsOffset, rowCount, scratchOffset) {
+    let [inputOffset, inputHeight, inputWidth, inputChannels] = this.upstreamLayers[0].currentForwardOutput();
+
+    instance.exports.pointwise_convolution_pixel_shuffle_backward_sparse(
+      gradient,
+      this.needsInputGradient ? this.bufferOffsets[1] : 0,
+      this.gradientOffsets[0],
+      this.gradientOffsets[1],
+      inputOffset,
+      this.packedParameterOffsets[1],
+      scratchOffset,
+      rowsOffset,
+      rowCount,
+      inputHeight,
+      inputWidth,
+      this.channelsIn,
+      this.channelsOut,
+      0
+    );
+  }
+
   currentForwardOutput() {
     return [
       this.bufferOffsets[0],
@@ -909,22 +1068,278 @@ class PointwiseConvolutionLayer extends Layer {
       this.channelsIn
     ];
   }
+
+  // Subclasses keep the inputs that only backward reads, such as the pre-activation or the unshuffled pixels,
+  // while training.
+  setTrainingMode() {
+    this.training = true;
+  }
+
+  setInferenceMode() {
+    this.training = false;
+  }
+}
+
+class PointwiseConvolutionHardSwishLayer extends PointwiseConvolutionLayer {
+  // With halfPrecision, the output and the pre-activation kept for backward are stored as bfloat16.
+  constructor(upstreamLayer, channelsIn, channelsOut, gain = 1.0, blocked = false, halfPrecision = false) {
+    super(upstreamLayer, channelsIn, channelsOut, gain, blocked);
+
+    this.halfPrecision = halfPrecision;
+
+    this.bufferSizes.push(null);
+    this.bufferSizes.push(null);
+    this.bufferOffsets.push(null);
+    this.bufferOffsets.push(null);
+  }
+
+  bufferSizesFor(height, width, channels) {
+    const bufferSizes = super.bufferSizesFor(height, width, channels);
+
+    bufferSizes[0] = storedSize(bufferSizes[0], this.halfPrecision); // y
+    bufferSizes.push(this.trainable ? storedSize(height * width * storedChannels(this.channelsOut, this.blocked), this.halfPrecision) : 0); // pre_activation
+    bufferSizes.push(this.trainable ? 32 * this.channelsOut : 0); // d_pre_activation, one 32-pixel tile at a time
+
+    return bufferSizes;
+  }
+
+  forward() {
+    let [inputOffset, inputHeight, inputWidth, inputChannels] = this.upstreamLayers[0].currentForwardOutput();
+
+    const forward = this.halfPrecision ? instance.exports.pointwise_convolution_hard_swish_forward_bf16 : instance.exports.pointwise_convolution_hard_swish_forward;
+
+    // The pre-activation is only needed by backward, so inference skips writing it.
+    forward(
+      inputOffset,
+      this.bufferOffsets[0],
+      this.training ? this.bufferOffsets[2] : 0,
+      this.packedParameterOffsets[0],
+      this.parameterOffsets[1],
+      inputHeight,
+      inputWidth,
+      this.channelsIn,
+      this.channelsOut,
+      this.upstreamLayers[0].blocked ? 1 : 0,
+      this.blocked ? 1 : 0
+    );
+
+    this.currentHeight = inputHeight;
+    this.currentWidth = inputWidth;
+    this.currentChannels = this.channelsOut;
+  }
+
+  forwardQuantized(scratchOffset) {
+    let [inputOffset, inputHeight, inputWidth, inputChannels] = this.upstreamLayers[0].currentForwardOutput();
+
+    instance.exports.quantized_pointwise_convolution_forward(
+      inputOffset,
+      this.bufferOffsets[0],
+      this.quantizedParameterOffsets[0],
+      this.quantizedParameterOffsets[1],
+      this.parameterOffsets[1],
+      scratchOffset,
+      this.inputScale,
+      inputHeight,
+      inputWidth,
+      this.channelsIn,
+      this.channelsOut,
+      1
+    );
+
+    this.currentHeight = inputHeight;
+    this.currentWidth = inputWidth;
+    this.currentChannels = this.channelsOut;
+  }
+
+  backward() {
+    let [inputOffset, inputHeight, inputWidth, inputChannels] = this.upstreamLayers[0].currentForwardOutput();
+
+    const backward = this.halfPrecision ? instance.exports.pointwise_convolution_hard_swish_backward_bf16 : instance.exports.pointwise_convolution_hard_swish_backward;
+
+    for (const [index, downstreamLayer] of this.downstreamLayers.entries()) {
+      backward(
+        downstreamLayer.currentBackwardOutput()[0],
+        this.needsInputGradient ? this.bufferOffsets[1] : 0,
+        this.gradientOffsets[0],
+        this.gradientOffsets[1],
+        inputOffset,
+        this.bufferOffsets[2],
+        this.bufferOffsets[3],
+        this.packedParameterOffsets[1],
+        inputHeight,
+        inputWidth,
+        this.channelsIn,
+        this.channelsOut,
+        this.upstreamLayers[0].blocked ? 1 : 0,
+        this.blocked ? 1 : 0,
+        index > 0 ? 1 : 0
+      );
+    }
+  }
+}
+
+class PixelUnshufflePointwiseConvolutionLayer extends PointwiseConvolutionLayer {
+  pixelChannels = null;
+  stride = null;
+
+  constructor(upstreamLayer, pixelChannels, channelsOut, gain = 1.0, stride = 8) {
+    super(upstreamLayer, pixelChannels * stride * stride, channelsOut, gain);
+
+    this.pixelChannels = pixelChannels;
+    this.stride = stride;
+
+    // The intro convolution reads 8-bit pixels and stays in float when the rest of the network is quantized.
+    this.quantizedParameterSizes = [];
+
+    const packedKernelRgbaSize = Math.ceil(this.channelsOut / 8) * 8 * this.channelsIn;
+    this.packedParameterSizes.push(packedKernelRgbaSize);
+
+    this.bufferSizes.push(null);
+    this.bufferSizes.push(null);
+    this.bufferOffsets.push(null);
+    this.bufferOffsets.push(null);
+  }
+
+  packParameters() {
+    super.packParameters();
+    this.packScaledKernel();
+  }
+
+  // 8-bit input is normalized by folding 1 / 255 into a second copy of the packed kernel. Only the RGBA inference
+  // forward reads it, so training leaves it stale and setInferenceMode refreshes it.
+  packScaledKernel() {
+    instance.exports.pack_pointwise_convolution_kernel_scaled(
+      this.parameterOffsets[0],
+      this.packedParameterOffsets[2],
+      this.channelsIn,
+      this.channelsOut,
+      1.0 / 255.0
+    );
+  }
+
+  setInferenceMode() {
+    if (this.training) {
+      this.packScaledKernel();
+    }
+    super.setInferenceMode();
+  }
+
+  bufferSizesFor(height, width, channels) {
+    const bufferSizes = [];
+
+    const outputHeight = Math.trunc(height / this.stride);
+    const outputWidth = Math.trunc(width / this.stride);
+    bufferSizes.push(outputHeight * outputWidth * this.channelsOut); // y
+    bufferSizes.push(this.needsInputGradient ? outputHeight * outputWidth * this.channelsIn : 0); // d_unshuffled
+    bufferSizes.push(this.trainable ? outputHeight * outputWidth * this.channelsIn : 0); // unshuffled
+    bufferSizes.push(this.needsInputGradient ? height * width * this.pixelChannels : 0); // d_x
+
+    return bufferSizes;
+  }
+
+  outputShapeFor(height, width, channels) {
+    return [Math.trunc(height / this.stride), Math.trunc(width / this.stride), this.channelsOut];
+  }
+
+  forward() {
+    let [inputOffset, inputHeight, inputWidth, inputChannels] = this.upstreamLayers[0].currentForwardOutput();
+
+    const outputHeight = Math.trunc(inputHeight / this.stride);
+    const outputWidth = Math.trunc(inputWidth / this.stride);
+
+    if (inputChannels === channelsRgba) {
+      instance.exports.pixel_unshuffle_pointwise_convolution_rgba_forward(
+        inputOffset,
+        this.bufferOffsets[0],
+        this.packedParameterOffsets[2],
+        this.parameterOffsets[1],
+        outputHeight,
+        outputWidth,
+        this.channelsOut
+      );
+    }
+    else {
+      // The unshuffled tensor is only needed by backward, so inference never writes it.
+      instance.exports.pixel_unshuffle_pointwise_convolution_forward(
+        inputOffset,
+        this.bufferOffsets[0],
+        this.training ? this.bufferOffsets[2] : 0,
+        this.packedParameterOffsets[0],
+        this.parameterOffsets[1],
+        outputHeight,
+        outputWidth,
+        this.channelsOut
+      );
+    }
+
+    this.currentHeight = outputHeight;
+    this.currentWidth = outputWidth;
+    this.currentChannels = this.channelsOut;
+  }
+
+  backward() {
+    for (const [index, downstreamLayer] of this.downstreamLayers.entries()) {
+      instance.exports.pointwise_convolution_backward(
+        downstreamLayer.currentBackwardOutput()[0],
+        this.needsInputGradient ? this.bufferOffsets[1] : 0,
+        this.gradientOffsets[0],
+        this.gradientOffsets[1],
+        this.bufferOffsets[2],
+        this.packedParameterOffsets[1],
+        this.currentHeight,
+        this.currentWidth,
+        this.channelsIn,
+        this.channelsOut,
+        0,
+        this.blocked ? 1 : 0,
+        index > 0 ? 1 : 0
+      );
+    }
+
+    if (this.needsInputGradient) {
+      instance.exports.pixel_unshuffle_backward(
+        this.bufferOffsets[1],
+        this.bufferOffsets[3],
+        this.currentHeight,
+        this.currentWidth,
+        this.channelsIn,
+        0
+      );
+    }
+  }
+
+  currentBackwardOutput() {
+    let [inputOffset, inputHeight, inputWidth, inputChannels] = this.upstreamLayers[0].currentForwardOutput();
+    return [
+      this.bufferOffsets[3],
+      inputHeight,
+      inputWidth,
+      this.pixelChannels
+    ];
+  }
 }
 
 
+
 class DepthwiseConvolutionLayer extends Layer {
   channels = null;
   filterSize = null;
+  stride = null;
   gain = null;
+  emitStatistics = false;
+  inputRange = 0; // The largest input magnitude seen by NeuralNetwork.calibrate()
+  inputScale = null;
 
-  constructor(upstreamLayer, channels, filterSize, gain = 1.0) {
+  constructor(upstreamLayer, channels, filterSize, gain = 1.0, stride = 1) {
     super();
     upstreamLayer.downstreamLayers.push(this);
     this.upstreamLayers.push(upstreamLayer);
 
     this.channels = channels;
     this.filterSize = filterSize;
+    this.stride = stride;
     this.gain = gain;
+    this.blocked = upstreamLayer.blocked;
 
     const kernelSize = this.channels * this.filterSize * this.filterSize;
     const biasSize = this.channels;
@@ -933,10 +1348,23 @@ class DepthwiseConvolutionLayer extends Layer {
     this.gradientSizes.push(kernelSize);
     this.gradientSizes.push(biasSize);
 
+    // The int8 taps in pairs of columns (4 taps per element) and the per-channel scales.
+    const quantizedKernelSize = Math.ceil(this.channels / 4) * 4 * this.filterSize * Math.ceil(this.filterSize / 2) * 2 / 4;
+    this.quantizedParameterSizes.push(quantizedKernelSize);
+    this.quantizedParameterSizes.push(this.channels);
+
+    this.bufferSizes.push(null);
+    this.bufferSizes.push(null);
+    this.bufferSizes.push(null);
+    this.bufferSizes.push(null);
     this.bufferSizes.push(null);
     this.bufferSizes.push(null);
     this.bufferOffsets.push(null);
     this.bufferOffsets.push(null);
+    this.bufferOffsets.push(null);
+    this.bufferOffsets.push(null);
+    this.bufferOffsets.push(null);
+    this.bufferOffsets.push(null);
   }
 
   initializeParametersAndGradients() {
@@ -972,52 +1400,80 @@ class DepthwiseConvolutionLayer extends Layer {
     instance.exports.zero(this.gradientOffsets[1], this.gradientSizes[1]);
   }
 
+  quantizeParameters(inputScale) {
+    this.inputScale = inputScale;
+    instance.exports.quantize_depthwise_convolution_kernel(
+      this.parameterOffsets[0],
+      this.quantizedParameterOffsets[0],
+      this.quantizedParameterOffsets[1],
+      this.channels,
+      this.filterSize
+    );
+  }
+
   bufferSizesFor(height, width, channels) {
     const bufferSizes = [];
 
-    bufferSizes.push(height * width * channels); // y
-    bufferSizes.push(height * width * channels); // d_x
+    bufferSizes.push(Math.ceil(height / this.stride) * Math.ceil(width / this.stride) * storedChannels(channels, this.blocked)); // y
+    bufferSizes.push(height * width * storedChannels(channels, this.blocked)); // d_x
+    bufferSizes.push(this.filterSize * (width + this.filterSize - 1) * Math.ceil(channels / 4) * 4); // padded input rows
+    bufferSizes.push(this.filterSize * (width + this.filterSize - 1) * Math.ceil(channels / 4) * 4); // padded gradient rows
+    bufferSizes.push(channels); // sum
+    bufferSizes.push(channels); // sum_of_squares
 
     return bufferSizes;
   }
 
   outputShapeFor(height, width, channels) {
-    return [height, width, channels];
+    return [Math.ceil(height / this.stride), Math.ceil(width / this.stride), channels];
   }
 
   forward() {
     let [inputOffset, inputHeight, inputWidth, inputChannels] = this.upstreamLayers[0].currentForwardOutput();
+    const forward = this.upstreamLayers[0].halfPrecision ? instance.exports.depthwise_convolution_forward_bf16 : instance.exports.depthwise_convolution_forward;
 
-    instance.exports.depthwise_convolution_forward(
+    forward(
       inputOffset,
       this.bufferOffsets[0],
       this.parameterOffsets[0],
       this.parameterOffsets[1],
+      this.bufferOffsets[2],
+      this.emitStatistics ? this.bufferOffsets[4] : 0,
+      this.emitStatistics ? this.bufferOffsets[5] : 0,
       inputHeight,
       inputWidth,
-      inputChannels
+      inputChannels,
+      this.filterSize,
+      this.stride,
+      this.blocked ? 1 : 0
     );
 
-    this.currentHeight = inputHeight;
-    this.currentWidth = inputWidth;
+    this.currentHeight = Math.ceil(inputHeight / this.stride);
+    this.currentWidth = Math.ceil(inputWidth / this.stride);
     this.currentChannels = inputChannels;
   }
 
   backward() {
     let [inputOffset, inputHeight, inputWidth, inputChannels] = this.upstreamLayers[0].currentForwardOutput();
-    instance.exports.zero(this.bufferOffsets[1], this.bufferSizes[1]);
+    const backward = this.upstreamLayers[0].halfPrecision ? instance.exports.depthwise_convolution_backward_bf16 : instance.exports.depthwise_convolution_backward;
 
-    for (const downstreamLayer of this.downstreamLayers) {
-      instance.exports.depthwise_convolution_backward(
+    for (const [index, downstreamLayer] of this.downstreamLayers.entries()) {
+      backward(
         downstreamLayer.currentBackwardOutput()[0],
         this.bufferOffsets[1],
         this.gradientOffsets[0],
         this.gradientOffsets[1],
         this.parameterOffsets[0],
         inputOffset,
+        this.bufferOffsets[2],
+        this.bufferOffsets[3],
         inputHeight,
         inputWidth,
-        inputChannels
+        inputChannels,
+        this.filterSize,
+        this.stride,
+        this.blocked ? 1 : 0,
+        index > 0 ? 1 : 0
       );
     }
   }
@@ -1032,23 +1488,154 @@ class DepthwiseConvolutionLayer extends Layer {
   }
 
   currentBackwardOutput() {
+    let [inputOffset, inputHeight, inputWidth, inputChannels] = this.upstreamLayers[0].currentForwardOutput();
     return [
       this.bufferOffsets[1],
-      this.currentHeight,
-      this.currentWidth,
-      this.currentChannels
+      inputHeight,
+      inputWidth,
+      inputChannels
     ];
   }
+
+  requestStatistics() {
+    this.emitStatistics = true;
+  }
+
+  currentStatistics() {
+    if (!this.emitStatistics) {
+      return null;
+    }
+    return [this.bufferOffsets[4], this.bufferOffsets[5]];
+  }
+}
+
+
+// Runs the layers of one inverted residual block as a single kernel in inference. The expanded tensors stay
+// in cache except for the depthwise output, whose statistics are needed before the reduction can start.
+class InvertedResidualBlock {
+  expansionConv = null;
+  depthwiseConv = null;
+  instanceNorm = null;
+  reductionConv = null;
+  addition = null;
+
+  constructor(expansionConv, depthwiseConv, instanceNorm, reductionConv, addition) {
+    this.expansionConv = expansionConv;
+    this.depthwiseConv = depthwiseConv;
+    this.instanceNorm = instanceNorm;
+    this.reductionConv = reductionConv;
+    this.addition = addition;
+  }
+
+  scratchSizeFor(width) {
+    const channels = this.expansionConv.channelsIn;
+    const channelsExpanded = this.expansionConv.channelsOut;
+    return width * channelsExpanded + 2 * channelsExpanded + channels + Math.ceil(channels / 8) * 8 * channelsExpanded;
+  }
+
+  quantizedScratchSizeFor(width) {
+    const channels = this.expansionConv.channelsIn;
+    const channelsExpanded = this.expansionConv.channelsOut;
+    const padding = Math.trunc(this.depthwiseConv.filterSize / 2);
+    const quantizedBytes = Math.max(
+      (width + 2 * padding + 1) * Math.ceil(channelsExpanded / 4) * 4,
+      4 * Math.ceil(channels / 2) * 2,
+      4 * Math.ceil(channelsExpanded / 2) * 2
+    );
+    return Math.max(width, 4) * channelsExpanded + 4 * channelsExpanded + Math.ceil(quantizedBytes / 4);
+  }
+
+  forward(scratchOffset) {
+    let [inputOffset, inputHeight, inputWidth, inputChannels] = this.expansionConv.upstreamLayers[0].currentForwardOutput();
+
+    instance.exports.inverted_residual_block_forward(
+      inputOffset,
+      this.addition.bufferOffsets[0],
+      this.expansionConv.packedParameterOffsets[0],
+      this.expansionConv.parameterOffsets[1],
+      this.depthwiseConv.parameterOffsets[0],
+      this.instanceNorm.parameterOffsets[0],
+      this.instanceNorm.parameterOffsets[1],
+      this.reductionConv.parameterOffsets[0],
+      this.reductionConv.parameterOffsets[1],
+      this.depthwiseConv.bufferOffsets[0],
+      this.depthwiseConv.bufferOffsets[2],
+      scratchOffset,
+      this.instanceNorm.epsilon,
+      inputHeight,
+      inputWidth,
+      inputChannels,
+      this.expansionConv.channelsOut,
+      this.depthwiseConv.filterSize
+    );
+
+    this.addition.currentHeight = inputHeight;
+    this.addition.currentWidth = inputWidth;
+    this.addition.currentChannels = inputChannels;
+  }
+
+  // forward() with the int8 kernels. The activations are requantized after the instance normalization, using the
+  // input scale of the reduction.
+  forwardQuantized(scratchOffset) {
+    let [inputOffset, inputHeight, inputWidth, inputChannels] = this.expansionConv.upstreamLayers[0].currentForwardOutput();
+
+    instance.exports.quantized_inverted_residual_block_forward(
+      inputOffset,
+      this.addition.bufferOffsets[0],
+      this.expansionConv.quantizedParameterOffsets[0],
+      this.expansionConv.quantizedParameterOffsets[1],
+      this.expansionConv.parameterOffsets[1],
+      this.depthwiseConv.quantizedParameterOffsets[0],
+      this.depthwiseConv.quantizedParameterOffsets[1],
+      this.instanceNorm.parameterOffsets[0],
+      this.instanceNorm.parameterOffsets[1],
+      this.reductionConv.quantizedParameterOffsets[0],
+      this.reductionConv.quantizedParameterOffsets[1],
+      this.reductionConv.parameterOffsets[1],
+      this.depthwiseConv.bufferOffsets[0],
+      this.depthwiseConv.bufferOffsets[2],
+      scratchOffset,
+      this.expansionConv.inputScale,
+      this.depthwiseConv.inputScale,
+      this.reductionConv.inputScale,
+      this.instanceNorm.epsilon,
+      inputHeight,
+      inputWidth,
+      inputChannels,
+      this.expansionConv.channelsOut,
+      this.depthwiseConv.filterSize
+    );
+
+    this.addition.currentHeight = inputHeight;
+    this.addition.currentWidth = inputWidth;
+    this.addition.currentChannels = inputChannels;
+  }
+
+  // Refills the intermediates of a checkpointed block, whose buffers are shared with the other checkpointed blocks,
+  // from its input before its backward. The reduction output is only needed to form the block output, which is kept.
+  recompute() {
+    this.expansionConv.forward();
+    this.depthwiseConv.forward();
+    this.instanceNorm.forward();
+  }
 }
 
 
 export class NeuralNetwork {
   layers = [];
   layersReversed = [];
+  blocks = new Map();
+  recomputedBlocks = new Map(); // Checkpointed blocks by their reduction convolution, where backward recomputes them
+  blockScratchSize = 0;
+  training = false;
+  quantizedLayers = []; // The layers quantize() converts to int8, in the order of activationRanges()
+  quantized = false;
 
   parameterOffset = null;
   gradientOffset = null;
   optimizerOffset = null;
+  packedParameterOffset = null;
+  quantizedParameterOffset = null;
   bufferOffset = null;
 
   parameterLength = null;
@@ -1062,15 +1649,41 @@ export class NeuralNetwork {
   blockCount = null;
 
   learningRate = null;
-
+  trainable = null;
+  blockedLayout = null;
+  lossBackgroundSamples = null;
+  halfPrecision = null;
+  checkpointRatio = null;
+  gaussianStdDev = null;
+  sparseRowCount = null;
+
+  // A network built without a learningRate, as for analysis, is inference-only and leaves out the buffers that only
+  // backward reads.
+  // blockedLayout keeps the expanded tensors inside each inverted residual block channel-blocked (NHWc4) during
+  // training, so the depthwise convolution and instance normalization work on whole vectors of one plane.
+  // lossBackgroundSamples > 0 selects the sparse loss, which is exact inside each keypoint's Gaussian window and
+  // estimated from that many random background elements elsewhere; the outro backward then only visits the rows
+  // those touch.
+  // halfPrecision stores the expansion outputs of the inverted residual blocks and the pre-activations kept for
+  // backward as bfloat16, which halves the largest activations of training; the kernels widen them to float.
+  // checkpointRatio is the fraction of the inverted residual blocks, counted from the first, that keep only their
+  // outputs: their expanded intermediates share one set of buffers and backward recomputes them from the block input.
   // constructor(channelsIn = 1, channelsMiddle, channelsOut, blockCount, maxImageSize, learningRate) {
-  constructor(channelsIn = 3, channelsMiddle, channelsOut, blockCount, maxImageSize, learningRate) {
+  constructor(channelsIn = 3, channelsMiddle, channelsOut, blockCount, maxImageSize, learningRate, blockedLayout = false, lossBackgroundSamples = 0, halfPrecision = false, checkpointRatio = 0) {
     this.channelsIn = channelsIn;
     this.channelsMiddle = channelsMiddle;
     this.channelsOut = channelsOut;
     this.blockCount = blockCount;
     this.maxImageSize = maxImageSize;
     this.learningRate = learningRate;
+    this.trainable = learningRate !== null;
+    this.blockedLayout = blockedLayout;
+    this.lossBackgroundSamples = lossBackgroundSamples;
+    this.halfPrecision = halfPrecision;
+    this.checkpointRatio = checkpointRatio;
+
+    const checkpointedBlockCount = Math.round(Math.min(Math.max(this.checkpointRatio, 0.0), 1.0) * this.blockCount);
+    let firstCheckpointedBlock = null;
 
     let expansionRatio = 2;
     let outroExpansionRatio = 2;
@@ -1078,10 +1691,7 @@ export class NeuralNetwork {
     const inputLayer = new InputLayer();
     this.layers.push(inputLayer);
 
-    const introPixelUnshuffle = new PixelUnshuffleLayer(inputLayer, 8);
-    this.layers.push(introPixelUnshuffle);
-
-    const introPointwiseConv = new PointwiseConvolutionLayer(introPixelUnshuffle, channelsIn * 8 * 8, this.channelsMiddle, 1.0);
+    const introPointwiseConv = new PixelUnshufflePointwiseConvolutionLayer(inputLayer, channelsIn, this.channelsMiddle, 1.0, 8);
     this.layers.push(introPointwiseConv);
 
     const introInstanceNorm = new InstanceNormalizationLayer(introPointwiseConv, this.channelsMiddle);
@@ -1090,13 +1700,10 @@ export class NeuralNetwork {
     let previousLayer = introInstanceNorm;
 
     for (let i = 0; i < this.blockCount; ++i) {
-      const expansionConv = new PointwiseConvolutionLayer(previousLayer, this.channelsMiddle, this.channelsMiddle * expansionRatio, Math.sqrt(2.0));
+      const expansionConv = new PointwiseConvolutionHardSwishLayer(previousLayer, this.channelsMiddle, this.channelsMiddle * expansionRatio, Math.sqrt(2.0), this.blockedLayout, this.halfPrecision);
       this.layers.push(expansionConv);
 
-      const hardSwish = new HardSwishLayer(expansionConv);
-      this.layers.push(hardSwish);
-
-      const depthwiseConv = new DepthwiseConvolutionLayer(hardSwish, this.channelsMiddle * expansionRatio, 5, 1.0);
+      const depthwiseConv = new DepthwiseConvolutionLayer(expansionConv, this.channelsMiddle * expansionRatio, 5, 1.0);
       this.layers.push(depthwiseConv);
 
       const instanceNorm = new InstanceNormalizationLayer(depthwiseConv, this.channelsMiddle * expansionRatio);
@@ -1108,19 +1715,38 @@ export class NeuralNetwork {
       const addition = new AdditionLayer([previousLayer, reductionConv]);
       this.layers.push(addition);
 
+      const block = new InvertedResidualBlock(expansionConv, depthwiseConv, instanceNorm, reductionConv, addition);
+      this.blocks.set(expansionConv, block);
+
+      if (i < checkpointedBlockCount) {
+        if (firstCheckpointedBlock === null) {
+          firstCheckpointedBlock = block;
+        }
+        else {
+          expansionConv.bufferSource = firstCheckpointedBlock.expansionConv;
+          depthwiseConv.bufferSource = firstCheckpointedBlock.depthwiseConv;
+          instanceNorm.bufferSource = firstCheckpointedBlock.instanceNorm;
+          reductionConv.bufferSource = firstCheckpointedBlock.reductionConv;
+        }
+        // The last checkpointed block is the last to write the shared buffers in forward, so it needs no recompute.
+        if (i < checkpointedBlockCount - 1) {
+          this.recomputedBlocks.set(reductionConv, block);
+        }
+      }
+      const blockWidth = Math.trunc(this.maxImageSize / introPointwiseConv.stride);
+      this.blockScratchSize = Math.max(this.blockScratchSize, block.scratchSizeFor(blockWidth), block.quantizedScratchSizeFor(blockWidth));
+      this.quantizedLayers.push(expansionConv, depthwiseConv, reductionConv);
+
       previousLayer = addition;
     }
 
     const outroExpansionConvDropout = new DropoutLayer(previousLayer, 0.1);
     this.layers.push(outroExpansionConvDropout);
 
-    const outroExpansionConv = new PointwiseConvolutionLayer(outroExpansionConvDropout, this.channelsMiddle, this.channelsMiddle * outroExpansionRatio, Math.sqrt(2.0));
+    const outroExpansionConv = new PointwiseConvolutionHardSwishLayer(outroExpansionConvDropout, this.channelsMiddle, this.channelsMiddle * outroExpansionRatio, Math.sqrt(2.0));
     this.layers.push(outroExpansionConv);
 
-    const outroHardSwish = new HardSwishLayer(outroExpansionConv, false);
-    this.layers.push(outroHardSwish);
-
-    const outroLinearConvDropout = new DropoutLayer(outroHardSwish, 0.2);
+    const outroLinearConvDropout = new DropoutLayer(outroExpansionConv, 0.2);
     this.layers.push(outroLinearConvDropout);
 
     const outroLinearConv = new PointwiseConvolutionLayer(outroLinearConvDropout, this.channelsMiddle * outroExpansionRatio, channelsOut * 4 * 4, 0.0);
@@ -1129,10 +1755,21 @@ export class NeuralNetwork {
     const outroPixelShuffle = new PixelShuffleLayer(outroLinearConv, 4);
     this.layers.push(outroPixelShuffle);
 
+    this.quantizedLayers.push(outroExpansionConv, outroLinearConv);
+    this.blockScratchSize = Math.max(this.blockScratchSize, outroExpansionConv.quantizedScratchSize(), outroLinearConv.quantizedScratchSize());
+
     const outputLayer = new OutputLayer(outroPixelShuffle);
 
     this.layers.push(outputLayer);
 
+    // A layer's input gradient is only worth computing if some layer upstream of it has parameters.
+    for (const layer of this.layers) {
+      layer.needsInputGradient = layer.upstreamLayers.some(
+        (upstreamLayer) => upstreamLayer.parameterSizes.length > 0 || upstreamLayer.needsInputGradient
+      );
+      layer.trainable = this.trainable;
+    }
+
     this.layersReversed = this.layers.toReversed();
     this.initializeParametersAndGradients();
   }
@@ -1164,21 +1801,25 @@ export class NeuralNetwork {
     this.parameterLength = (this.gradientOffset - this.parameterOffset) / elementByteSize;
     offset += 2 * this.parameterLength * elementByteSize;
 
-    this.bufferOffset = offset;
+    this.packedParameterOffset = offset;
+    for (const layer of this.layers) {
+      for (const packedParameterSize of layer.packedParameterSizes) {
+        layer.packedParameterOffsets.push(offset);
+        offset += packedParameterSize * elementByteSize;
+      }
+    }
 
-    let tempHeight = this.maxImageSize;
-    let tempWidth = this.maxImageSize;
-    let tempChannels = this.channelsIn;
+    this.quantizedParameterOffset = offset;
     for (const layer of this.layers) {
-      const bufferSizes = layer.bufferSizesFor(tempHeight, tempWidth, tempChannels);
-      for (let i = 0; i < bufferSizes.length; ++i) {
-        layer.bufferSizes[i] = bufferSizes[i];
-        layer.bufferOffsets[i] = offset;
-        offset += layer.bufferSizes[i] * elementByteSize;
+      for (const quantizedParameterSize of layer.quantizedParameterSizes) {
+        layer.quantizedParameterOffsets.push(offset);
+        offset += quantizedParameterSize * elementByteSize;
       }
-      [tempHeight, tempWidth, tempChannels] = layer.outputShapeFor(tempHeight, tempWidth, tempChannels);
     }
 
+    this.bufferOffset = offset;
+    offset = this.assignBuffers(this.maxImageSize, this.maxImageSize, this.channelsIn);
+
     this.originalOffset = offset;
 
     offset += this.maxImageSize * this.maxImageSize * 4 * elementByteSize;
@@ -1194,6 +1835,25 @@ export class NeuralNetwork {
     offset += (this.maxImageSize / 2) * (this.maxImageSize / 2) * 10 * elementByteSize;
     this.gaussianCoordinatesOffset = offset;
     offset += 2 * 10 * elementByteSize;
+    this.lossSamplesOffset = offset;
+    offset += this.lossBackgroundSamples * elementByteSize;
+    this.lossRowsOffset = offset;
+    offset += (this.maxImageSize / 8) * (this.maxImageSize / 8) * elementByteSize;
+    this.lossRowFlagsOffset = offset;
+    offset += (this.maxImageSize / 8) * (this.maxImageSize / 8) * elementByteSize;
+    this.lossRowCountOffset = offset;
+    offset += 1 * elementByteSize;
+    this.lossScratchOffset = offset;
+    const outroLinearConv = this.layers[this.layers.length - 3];
+    offset += 32 * (outroLinearConv.channelsOut + 2 * outroLinearConv.channelsIn) * elementByteSize;
+    this.peakValuesOffset = offset;
+    offset += this.channelsOut * elementByteSize;
+    this.peakIndicesOffset = offset;
+    offset += this.channelsOut * elementByteSize;
+    this.peakScratchOffset = offset;
+    offset += (4 * this.channelsOut * 4 * 4 + outroLinearConv.quantizedScratchSize()) * elementByteSize;
+    this.blockScratchOffset = offset;
+    offset += this.blockScratchSize * elementByteSize;
 
     this.lastOffset = offset;
 
@@ -1206,9 +1866,18 @@ export class NeuralNetwork {
     for (const layer of this.layers) {
       layer.initializeParametersAndGradients();
     }
+    this.packParameters();
   }
 
-  forward(image, height, width, channels) {
+  packParameters() {
+    for (const layer of this.layers) {
+      layer.packParameters();
+    }
+  }
+
+  // Lays out the layer buffers from bufferOffset for the given input shape and returns the offset past them. A layer
+  // with a bufferSource reuses that layer's buffers, which come earlier in this.layers.
+  assignBuffers(height, width, channels) {
     let offset = this.bufferOffset;
 
     let tempHeight = height;
@@ -1219,12 +1888,128 @@ export class NeuralNetwork {
       const bufferSizes = layer.bufferSizesFor(tempHeight, tempWidth, tempChannels);
       for (let i = 0; i < bufferSizes.length; ++i) {
         layer.bufferSizes[i] = bufferSizes[i];
-        layer.bufferOffsets[i] = offset;
-        offset += layer.bufferSizes[i] * elementByteSize;
+        if (layer.bufferSource !== null) {
+          layer.bufferOffsets[i] = layer.bufferSource.bufferOffsets[i];
+        }
+        else {
+          layer.bufferOffsets[i] = offset;
+          offset += layer.bufferSizes[i] * elementByteSize;
+        }
       }
       [tempHeight, tempWidth, tempChannels] = layer.outputShapeFor(tempHeight, tempWidth, tempChannels);
     }
 
+    return offset;
+  }
+
+  // Runs the layers before end, or all of them. With fused, which is the default in inference, each inverted
+  // residual block runs as one kernel and, after quantize(), the quantized layers run on their int8 kernels.
+  forwardLayers(image, height, width, channels, end = null, fused = !this.training) {
+    let fusedBlockEnd = null;
+
+    let index = 0;
+    for (const layer of this.layers) {
+      if (layer === end) {
+        break;
+      }
+      if (fusedBlockEnd !== null) {
+        // Already computed by the fused block.
+        if (layer === fusedBlockEnd) {
+          fusedBlockEnd = null;
+        }
+      }
+      else if (index === 0) {
+        layer.forward(image, height, width, channels); // Feed data to input layer.
+      }
+      else if (fused && this.blocks.has(layer)) {
+        const block = this.blocks.get(layer);
+        if (this.quantized) {
+          block.forwardQuantized(this.blockScratchOffset);
+        }
+        else {
+          block.forward(this.blockScratchOffset);
+        }
+        fusedBlockEnd = block.addition;
+      }
+      else if (fused && this.quantized && this.quantizedLayers.includes(layer)) {
+        layer.forwardQuantized(this.blockScratchOffset);
+      }
+      else {
+        layer.forward();
+      }
+      ++index;
+    }
+  }
+
+  forward(image, height, width, channels) {
+    this.assignBuffers(height, width, channels);
+    this.forwardLayers(image, height, width, channels);
+  }
+
+  // Inference-only forward that returns the location of the maximum of every heatmap, like argmax or
+  // argmaxWithinCircle on predictions(), without writing the heatmaps.
+  forwardPeaks(image, height, width, channels, withinCircle = false) {
+    this.assignBuffers(height, width, channels);
+
+    const outroLinearConv = this.layers[this.layers.length - 3];
+    this.forwardLayers(image, height, width, channels, outroLinearConv);
+
+    let [inputOffset, inputHeight, inputWidth, inputChannels] = outroLinearConv.upstreamLayers[0].currentForwardOutput();
+
+    if (this.quantized) {
+      instance.exports.quantized_pointwise_convolution_pixel_shuffle_argmax(
+        inputOffset,
+        outroLinearConv.quantizedParameterOffsets[0],
+        outroLinearConv.quantizedParameterOffsets[1],
+        outroLinearConv.parameterOffsets[1],
+        this.peakScratchOffset,
+        this.peakValuesOffset,
+        this.peakIndicesOffset,
+        outroLinearConv.inputScale,
+        inputHeight,
+        inputWidth,
+        outroLinearConv.channelsIn,
+        outroLinearConv.channelsOut,
+        withinCircle ? 1 : 0
+      );
+    }
+    else {
+      instance.exports.pointwise_convolution_pixel_shuffle_argmax(
+        inputOffset,
+        outroLinearConv.packedParameterOffsets[0],
+        outroLinearConv.parameterOffsets[1],
+        this.peakScratchOffset,
+        this.peakValuesOffset,
+        this.peakIndicesOffset,
+        inputHeight,
+        inputWidth,
+        outroLinearConv.channelsIn,
+        outroLinearConv.channelsOut,
+        withinCircle ? 1 : 0
+      );
+    }
+
+    const peakIndicesArray = new Int32Array(
+      instance.exports.memory.buffer,
+      this.peakIndicesOffset,
+      this.channelsOut
+    );
+
+    const shuffledWidth = inputWidth * 4;
+    const result = [];
+    for (let c = 0; c < this.channelsOut; ++c) {
+      result.push({ y: Math.trunc(peakIndicesArray[c] / shuffledWidth), x: peakIndicesArray[c] % shuffledWidth });
+    }
+
+    return result;
+  }
+
+  // Float inference forward, layer by layer so every activation is written out, that widens the recorded input
+  // range of each of quantizedLayers. The ranges are taken as soon as each input is written, since checkpointed
+  // blocks overwrite each other's intermediates.
+  calibrate(image, height, width, channels) {
+    this.assignBuffers(height, width, channels);
+
     let index = 0;
     for (const layer of this.layers) {
       if (index === 0) {
@@ -1234,10 +2019,41 @@ export class NeuralNetwork {
         layer.forward();
       }
       ++index;
+
+      for (const downstreamLayer of layer.downstreamLayers) {
+        if (this.quantizedLayers.includes(downstreamLayer)) {
+          let [outputOffset, outputHeight, outputWidth, outputChannels] = layer.currentForwardOutput();
+          const maxAbs = layer.halfPrecision ? instance.exports.max_abs_bf16 : instance.exports.max_abs;
+          downstreamLayer.inputRange = Math.max(downstreamLayer.inputRange, maxAbs(outputOffset, outputHeight * outputWidth * outputChannels));
+        }
+      }
+    }
+  }
+
+  resetActivationRanges() {
+    for (const layer of this.quantizedLayers) {
+      layer.inputRange = 0;
     }
   }
 
+  activationRanges() {
+    return this.quantizedLayers.map((layer) => layer.inputRange);
+  }
+
+  // Switches inference to int8 weights, quantized per output channel from the current parameters, and int8
+  // activations, quantized symmetrically over the given input ranges (from activationRanges()).
+  quantize(activationRanges) {
+    for (const [index, layer] of this.quantizedLayers.entries()) {
+      layer.quantizeParameters(Math.max(activationRanges[index], 1.0e-6) / 127.0);
+    }
+    this.quantized = true;
+  }
+
+  // Input gradient buffers are never zeroed before backward. Each layer's backward runs its kernel once per
+  // downstream layer, in the order of downstreamLayers; the first call overwrites the gradient buffer and later
+  // ones pass accumulate = 1 (index > 0) to add into it.
   backward(gradient) {
+    const sparse = this.lossBackgroundSamples > 0;
     let index = 0;
     for (const layer of this.layersReversed) {
       if (index === 0) {
@@ -1246,7 +2062,16 @@ export class NeuralNetwork {
       else if (index === this.layersReversed.length - 1) {
         // Don't backpropagate through input layer.
       }
+      else if (sparse && index === 1) {
+        // The pixel shuffle is folded into the sparse backward of the outro convolution.
+      }
+      else if (sparse && index === 2) {
+        layer.backwardSparse(gradient, this.lossRowsOffset, this.sparseRowCount, this.lossScratchOffset);
+      }
       else {
+        if (this.recomputedBlocks.has(layer)) {
+          this.recomputedBlocks.get(layer).recompute();
+        }
         layer.backward();
       }
       ++index;
@@ -1277,20 +2102,17 @@ export class NeuralNetwork {
 
     const scheduleMultiplier = 1.0;
 
-    instance.exports.update_parameters(
-      this.gradientOffset,
-      this.parameterOffset,
-      this.optimizerOffset, // first moment
-      this.optimizerOffset + this.parameterLength * elementByteSize, // second moment
-      this.parameterLength,
-      beta1,
-      beta2,
-      epsilon,
-      scheduleMultiplier,
-      this.learningRate,
-      weightDecay,
-      this.optimizerT
-    );
+    const hyperparameters = [beta1, beta2, epsilon, scheduleMultiplier, this.learningRate, weightDecay, this.optimizerT];
+
+    // The moments are laid out like the parameters, so each tensor's moments sit at its offset into the parameters.
+    // Updating tensor by tensor lets layers refresh their packed parameters while the new values are in cache.
+    for (const layer of this.layers) {
+      for (let i = 0; i < layer.parameterSizes.length; ++i) {
+        const firstMomentOffset = this.optimizerOffset + (layer.parameterOffsets[i] - this.parameterOffset);
+        const secondMomentOffset = firstMomentOffset + this.parameterLength * elementByteSize;
+        layer.updateParameter(i, firstMomentOffset, secondMomentOffset, hyperparameters);
+      }
+    }
     ++this.optimizerT;
   }
 
@@ -1308,6 +2130,21 @@ export class NeuralNetwork {
     instance.exports.resize_bilinear_rgba_to_rgb(this.originalOffset, this.resizedOffset, heightIn, widthIn, heightOut, widthOut);
   }
 
+  // Resizes into 8-bit RGBA at resizedOffset, which forward accepts directly with channelsRgba channels.
+  resizeRgba(x, heightIn, widthIn, heightOut, widthOut) {
+    const xArray = new Uint8ClampedArray(
+      instance.exports.memory.buffer,
+      this.originalOffset,
+      heightIn * widthIn * channelsRgba
+    );
+
+    for (let i = 0; i < heightIn * widthIn * channelsRgba; ++i) {
+      xArray[i] = x[i];
+    }
+
+    instance.exports.resize_bilinear_rgba(this.originalOffset, this.resizedOffset, heightIn, widthIn, heightOut, widthOut);
+  }
+
   flipHorizontal(height, width) {
     instance.exports.flip_horizontal(this.resizedOffset, height, width);
   }
@@ -1349,6 +2186,7 @@ export class NeuralNetwork {
     }
 
     instance.exports.draw_gaussians(this.gaussianOffset, resizedGaussianHeight, resizedGaussianWidth, keypointCount, this.gaussianCoordinatesOffset, gaussianStdDev);
+    this.gaussianStdDev = gaussianStdDev;
   }
 
   lossForward() {
@@ -1359,13 +2197,51 @@ export class NeuralNetwork {
     );
   }
 
-  lossBackward(loss) {
-    instance.exports.mean_squared_error_backward(
-      loss,
-      this.gaussianGradientOffset,
+  // Returns the loss and writes its gradient, scaled by lossGradient, in one pass over the heatmaps. lossWeighted
+  // also scales the gradient by the loss, as training does. The sparse loss returns an unbiased estimate of the same
+  // loss, and only writes the gradient in the rows backward() visits.
+  lossForwardBackward(lossGradient, lossWeighted = false) {
+    if (this.lossBackgroundSamples > 0) {
+      const outputLayer = this.layers[this.layers.length - 1];
+      const size = outputLayer.currentHeight * outputLayer.currentWidth * outputLayer.currentChannels;
+
+      const samplesArray = new Int32Array(
+        instance.exports.memory.buffer,
+        this.lossSamplesOffset,
+        this.lossBackgroundSamples
+      );
+      for (let i = 0; i < this.lossBackgroundSamples; ++i) {
+        samplesArray[i] = Math.min(randomWebAssemblyInstance.exports.random_integer(0, size), size - 1);
+      }
+
+      const loss = instance.exports.sparse_mean_squared_error_forward_backward(
+        this.layers[this.layers.length - 2].bufferOffsets[0],
+        this.gaussianOffset,
+        this.gaussianGradientOffset,
+        this.gaussianCoordinatesOffset,
+        this.lossSamplesOffset,
+        this.lossBackgroundSamples,
+        this.lossRowsOffset,
+        this.lossRowCountOffset,
+        this.lossRowFlagsOffset,
+        outputLayer.currentHeight,
+        outputLayer.currentWidth,
+        outputLayer.currentChannels,
+        this.gaussianStdDev,
+        lossGradient,
+        lossWeighted ? 1 : 0
+      );
+      this.sparseRowCount = new Int32Array(instance.exports.memory.buffer, this.lossRowCountOffset, 1)[0];
+      return loss;
+    }
+
+    return instance.exports.mean_squared_error_forward_backward(
       this.layers[this.layers.length - 2].bufferOffsets[0],
       this.gaussianOffset,
-      this.layers[this.layers.length - 1].currentHeight * this.layers[this.layers.length - 1].currentWidth * this.layers[this.layers.length - 1].currentChannels
+      this.gaussianGradientOffset,
+      this.layers[this.layers.length - 1].currentHeight * this.layers[this.layers.length - 1].currentWidth * this.layers[this.layers.length - 1].currentChannels,
+      lossGradient,
+      lossWeighted ? 1 : 0
     );
   }
 
@@ -1395,6 +2271,8 @@ export class NeuralNetwork {
     for (let i = 0; i < this.parameterLength; ++i) {
       parameterArrayActual[i] = parameterArray[i];
     }
+
+    this.packParameters();
   }
 
   seed(seed) {
@@ -1410,12 +2288,14 @@ export class NeuralNetwork {
   }
 
   setTrainingMode() {
+    this.training = true;
     for (const layer of this.layers) {
       layer.setTrainingMode();
     }
   }
 
   setInferenceMode() {
+    this.training = false;
     for (const layer of this.layers) {
       layer.setInferenceMode();
     }
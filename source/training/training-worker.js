@@ -38,6 +38,10 @@ class TrainingWorker extends SectionWorker {
   gradientAccumulationSize = 1;
 
   gaussianStdDev = 2.0;
+  lossBackgroundSamples = 0; // 0 trains on the dense loss.
+  halfPrecision = false; // Stores the largest training activations as bfloat16, for larger maxImageSize values.
+  checkpointRatio = 0; // Fraction of the blocks whose intermediates backward recomputes instead of keeping.
+  calibrationImageCount = 16; // Validation images that set the activation ranges of the quantized inference.
 
   horizontalFlip = false;
   verticalFlip = false;
@@ -122,6 +126,7 @@ class TrainingWorker extends SectionWorker {
 
     this.data.currentWeights = null;
     this.data.bestWeights = null;
+    this.data.bestActivationRanges = null;
   }
 
   sanityCheckData() {
@@ -201,7 +206,7 @@ class TrainingWorker extends SectionWorker {
   async startTraining() {
     if (this.neuralNetwork === null) {
       // this.neuralNetwork = new NeuralNetwork(1, this.data.channelCount, this.data.keypointCount, this.data.blockCount, this.data.maxImageSize, this.learningRate);
-      this.neuralNetwork = new NeuralNetwork(channelsRgb, this.data.channelCount, this.data.keypointCount, this.data.blockCount, this.data.maxImageSize, this.learningRate);
+      this.neuralNetwork = new NeuralNetwork(channelsRgb, this.data.channelCount, this.data.keypointCount, this.data.blockCount, this.data.maxImageSize, this.learningRate, false, this.lossBackgroundSamples, this.halfPrecision, this.checkpointRatio);
     }
 
     if (this.data.meanTrainingLosses === null) {
@@ -321,17 +326,16 @@ class TrainingWorker extends SectionWorker {
       // this.neuralNetwork.forward(this.neuralNetwork.grayOffset, resizedHeight, resizedWidth, 1);
       this.neuralNetwork.forward(this.neuralNetwork.rotatedOffset, resizedHeight, resizedWidth, channelsRgb);
 
-      const trainingLoss = this.neuralNetwork.lossForward();
+      // Each sample's gradient is weighted by its loss, so samples that are further off pull harder.
+      const trainingLoss = this.neuralNetwork.lossForwardBackward(1.0 / this.batchSize, true);
       meanTrainingLoss += trainingLoss;
-      this.neuralNetwork.lossBackward(trainingLoss / this.batchSize);
 
       this.neuralNetwork.backward(this.neuralNetwork.gaussianGradientOffset);
 
       // reminder: need to handle partial batches
       ++batchIndex;
       if (batchIndex === this.batchSize) {
-        this.neuralNetwork.updateParameters();
-        this.neuralNetwork.zeroGradients();
+        this.neuralNetwork.updateParameters(); // Also zeroes the gradients.
         batchIndex = 0;
       }
     }
@@ -403,6 +407,7 @@ class TrainingWorker extends SectionWorker {
       this.data.cachedPredictions = cachedPredictions;
 
       this.data.bestWeights = this.neuralNetwork.getParameters();
+      this.data.bestActivationRanges = await this.calibrate();
     }
 
     self.postMessage(
@@ -423,6 +428,30 @@ class TrainingWorker extends SectionWorker {
 
     ++this.epoch;
   }
+
+  // Records the activation ranges of the current parameters over the first calibrationImageCount validation images,
+  // for the quantized inference in analysis.
+  async calibrate() {
+    this.neuralNetwork.resetActivationRanges();
+    const calibrationImageCount = Math.min(this.calibrationImageCount, this.data.validationIndices.length);
+    for (let validationIndex = 0; validationIndex < calibrationImageCount; ++validationIndex) {
+      const image = this.data.labels[this.data.validationIndices[validationIndex]].image;
+      const imageResult = await fetch(image);
+      const imageBlob = await imageResult.blob();
+      const imageBitmap = await createImageBitmap(imageBlob, { colorSpaceConversion: "none" });
+
+      const canvas = new OffscreenCanvas(imageBitmap.width, imageBitmap.height);
+      const context = canvas.getContext("2d");
+      context.drawImage(imageBitmap, 0, 0, imageBitmap.width, imageBitmap.height);
+      const imageData = context.getImageData(0, 0, canvas.width, canvas.height);
+
+      const [resizedHeight, resizedWidth] = nearestValidImageSize(imageBitmap.height, imageBitmap.width, this.data.maxImageSize, 8);
+
+      this.neuralNetwork.resize(imageData.data, imageBitmap.height, imageBitmap.width, resizedHeight, resizedWidth);
+      this.neuralNetwork.calibrate(this.neuralNetwork.resizedOffset, resizedHeight, resizedWidth, channelsRgb);
+    }
+    return this.neuralNetwork.activationRanges();
+  }
 }
 
 